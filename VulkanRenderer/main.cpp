@@ -1,15 +1,42 @@
+#include <volk.h>
 #include <glfw3.h>
 #include <glfw3native.h>
-#include <volk.h>
 
 #include <iostream>
 #include <stdexcept>
+#include <exception>
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <string>
+
+#include <cmath>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <deque>
+#include <unordered_map>
 
 #include <vector>
 #include <array>
 #include <algorithm>
 
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 
@@ -86,1328 +113,6594 @@ void destroyDebugCallback(VkInstance instance, VkDebugReportCallbackEXT callback
     vkDestroyDebugReportCallbackEXT(instance, callback, 0);
 }
 
-// Write code first and as it becomes painful to deal with make it less painful to deal with
-// Semantic Compression by Casey Muratori
+// read-only view of a whole file mapped into memory
+struct MappedFile
+{
+    const void* data = nullptr;
+    size_t size = 0;
 
-class HelloTriangleApplication
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = 0;
+#endif
+};
+
+bool mapFile(MappedFile& result, const char* path)
 {
-public:
-    void Run()
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
     {
-        InitWindow();
-        InitVulkan();
-        MainLoop();
-        Cleanup();
+        CloseHandle(file);
+        return false;
     }
 
-private:
-    void InitWindow()
+    HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+    if (!mapping)
     {
-        glfwInit();
+        CloseHandle(file);
+        return false;
+    }
 
-        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API); // tell glfw to not create opengl context by default
-        glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
 
-        window = glfwCreateWindow(1024, 768, "Vulkan", nullptr, nullptr);
+    result.data = data;
+    result.size = size_t(size.QuadPart);
+    result.file = file;
+    result.mapping = mapping;
+#else
+    int file = open(path, O_RDONLY);
+    if (file < 0)
+        return false;
 
-        if (!window)
-            throw std::runtime_error("GLFW couldn't create window");
+    struct stat st;
+    if (fstat(file, &st) != 0 || st.st_size == 0)
+    {
+        close(file);
+        return false;
     }
 
-    void InitVulkan()
-    {
-        VK_CHECK(volkInitialize());
+    void* data = mmap(0, size_t(st.st_size), PROT_READ, MAP_PRIVATE, file, 0);
 
-        CreateInstance();
-        //DebugExtensionSupport();
-        
-        volkLoadInstance(instance);
+    // the mapping keeps the file alive on its own
+    close(file);
 
-        // Set Debug Callback for Validation Errors
-        debugMessenger = registerDebugCallback(instance);
+    if (data == MAP_FAILED)
+        return false;
 
-        CreatePhysicalAndLogicalDevice();
-        CreateSurface();
-        CreateVulkanSemaphores();
-        CreateCommandPool();
-    }
+    result.data = data;
+    result.size = size_t(st.st_size);
+#endif
 
-    VkPhysicalDevice PickPhysicalDevice(std::vector<VkPhysicalDevice>& pd, uint32_t pdc)
-    {
-        for (uint32_t i = 0; i < pdc; ++i)
-        {
-            VkPhysicalDeviceProperties props;
-            vkGetPhysicalDeviceProperties(pd[i], &props);
+    return true;
+}
 
-            queueFamilyIndex = GetGraphicsQueueFamily(pd[i]);
+void unmapFile(MappedFile& file)
+{
+    if (!file.data)
+        return;
 
-            if (queueFamilyIndex == VK_QUEUE_FAMILY_IGNORED)
-                continue;
+#ifdef _WIN32
+    UnmapViewOfFile(file.data);
+    CloseHandle(file.mapping);
+    CloseHandle(file.file);
+#else
+    munmap(const_cast<void*>(file.data), file.size);
+#endif
 
-            // check for presentation support on the device
-            if (!vkGetPhysicalDeviceWin32PresentationSupportKHR(pd[i], queueFamilyIndex))
-                continue;
+    file = MappedFile();
+}
 
-            if (props.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
-            {
-                std::cout << "Picking discrete GPU " << props.deviceName << std::endl;
-                return pd[i];
-            }
-        }
+// flushes a file written through stdio to the disk before closing it, so a later rename never exposes unwritten data
+bool closeFileSynced(FILE* file)
+{
+    bool synced = fflush(file) == 0;
 
-        // return the first device if no discrete gpu found
-        if (pdc > 0 && queueFamilyIndex != VK_QUEUE_FAMILY_IGNORED)
-        {
-            VkPhysicalDeviceProperties props;
-            vkGetPhysicalDeviceProperties(pd[0], &props);
+#ifdef _WIN32
+    synced = synced && _commit(_fileno(file)) == 0;
+#else
+    synced = synced && fsync(fileno(file)) == 0;
+#endif
 
-            std::cout << "Picking fallback GPU " << props.deviceName << std::endl;
-            return pd[0];
-        }
+    return (fclose(file) == 0) && synced;
+}
 
-        std::cout << "No physical devices available!" << std::endl;
-        return VK_NULL_HANDLE;
-    }
+// replaces path with tempPath in a single step, readers see either the old or the new file but never neither
+bool replaceFile(const char* tempPath, const char* path)
+{
+#ifdef _WIN32
+    return MoveFileExA(tempPath, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(tempPath, path) == 0;
+#endif
+}
 
+// murmur3 style mixing over 8 byte words, only used to detect changed source files so it doesn't need to be cryptographic
+uint64_t hashBytes(const void* data, size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
 
-    void CreateInstance()
+    uint64_t hash = 0x9e3779b97f4a7c15ull ^ size;
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
     {
-        // for portability should check if the used api version is available first
-        VkApplicationInfo appInfo{};
-        appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-        appInfo.pApplicationName = "MyFirstVulkanTriangle";
-        appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.pEngineName = "No Engine";
-        appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.apiVersion = VK_API_VERSION_1_3;
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
 
-        VkInstanceCreateInfo createInfo{};
-        createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-        createInfo.pApplicationInfo = &appInfo;
+        word *= 0x87c37b91114253d5ull;
+        word = (word << 31) | (word >> 33);
+        word *= 0x4cf5ad432745937full;
 
+        hash ^= word;
+        hash = ((hash << 27) | (hash >> 37)) * 5 + 0x52dce729;
+    }
 
-        // get required extensions from GLFW
-        uint32_t glfwExtensionCount = 0;
-        const char** glfwExtensions;
+    for (; i < size; ++i)
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
 
-        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    // final avalanche so that every input bit affects every output bit
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
 
-        std::vector<const char*> extensionNames(glfwExtensions, glfwExtensions + glfwExtensionCount);
+    return hash;
+}
 
-        extensionNames.push_back("VK_EXT_debug_report");
+// scoped cpu zones written as a chrome trace (chrome://tracing, ui.perfetto.dev) with --trace, build with TRACING=0 to compile the zones out
+#ifndef TRACING
+#define TRACING 1
+#endif
 
-        createInfo.enabledExtensionCount = static_cast<uint32_t>(extensionNames.size());
-        createInfo.ppEnabledExtensionNames = extensionNames.data();
+#if TRACING
+struct TraceEvent
+{
+    const char* name; // string literal
+    uint64_t begin;
+    uint64_t end;
+};
 
-#ifdef _DEBUG
-        const char* debugLayers[] =
-        {
-          "VK_LAYER_KHRONOS_validation"
-        };
+// every thread appends to its own buffer without locking, the buffers are only read once tracing stopped and stay alive after their thread exits
+struct TraceBuffer
+{
+    std::vector<TraceEvent> events;
+    const char* threadName = nullptr;
+    uint32_t threadId = 0;
+    TraceBuffer* next = nullptr;
+};
 
-        createInfo.ppEnabledLayerNames = debugLayers;
-        createInfo.enabledLayerCount = 1;
-#endif
+std::atomic<bool> traceEnabled(false);
+std::atomic<TraceBuffer*> traceBuffers(nullptr);
+std::atomic<uint32_t> traceThreadCount(0);
+thread_local TraceBuffer* traceThreadBuffer = nullptr;
 
-        VK_CHECK(vkCreateInstance(&createInfo, 0, &instance));
-    }
+uint64_t traceNow()
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
 
-    uint32_t GetGraphicsQueueFamily(VkPhysicalDevice pd)
+TraceBuffer* traceBuffer()
+{
+    if (!traceThreadBuffer)
     {
-        // Find a QueueFamily that supports graphics
-        uint32_t queueFamilyCount;
-        vkGetPhysicalDeviceQueueFamilyProperties(pd, &queueFamilyCount, 0);
-        std::vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyCount);
-        vkGetPhysicalDeviceQueueFamilyProperties(pd, &queueFamilyCount, queueFamilyProperties.data());
+        TraceBuffer* buffer = new TraceBuffer();
+        buffer->threadId = traceThreadCount++;
+        buffer->events.reserve(4096);
 
-        for (uint32_t i = 0; i < queueFamilyCount; ++i)
-        {
-            if (queueFamilyProperties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
-                return i;
-        }
+        // buffers are pushed onto a lock free list that is only walked by writeTrace
+        buffer->next = traceBuffers.load();
+        while (!traceBuffers.compare_exchange_weak(buffer->next, buffer))
+            ;
 
-        // throw std::runtime_error("No queue families support graphics. Is this a compute-only device?");
+        traceThreadBuffer = buffer;
+    }
 
-        return VK_QUEUE_FAMILY_IGNORED;
+    return traceThreadBuffer;
+}
+
+void traceThreadName(const char* name)
+{
+    if (traceEnabled)
+        traceBuffer()->threadName = name;
+}
+
+struct TraceZone
+{
+    const char* name;
+    uint64_t begin;
+    bool active;
+
+    explicit TraceZone(const char* name)
+        : name(name), begin(0), active(traceEnabled)
+    {
+        if (active)
+            begin = traceNow();
     }
 
-    void CreatePhysicalAndLogicalDevice()
+    ~TraceZone()
     {
-        uint32_t deviceCount;
-        VK_CHECK(vkEnumeratePhysicalDevices(instance, &deviceCount, 0));
-        std::vector<VkPhysicalDevice> physicalDevices(deviceCount);
-        VK_CHECK(vkEnumeratePhysicalDevices(instance, &deviceCount, physicalDevices.data()));
+        End();
+    }
 
-        physicalDevice = PickPhysicalDevice(physicalDevices, deviceCount);
-        if (physicalDevice == VK_NULL_HANDLE)
-            throw std::runtime_error("Abort! No Vulkan device found.");
+    void End()
+    {
+        if (!active)
+            return;
 
-        float queuePriorities[] = { 1.0f };
+        TraceEvent event = { name, begin, traceNow() };
+        traceBuffer()->events.push_back(event);
 
-        VkDeviceQueueCreateInfo queueInfo = { VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO };
-        queueInfo.queueFamilyIndex = queueFamilyIndex;
-        queueInfo.queueCount = 1;
-        queueInfo.pQueuePriorities = queuePriorities;
+        active = false;
+    }
+};
 
-        std::vector<const char*> extensions =
-        {
-          VK_KHR_SWAPCHAIN_EXTENSION_NAME,
-          VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME,
-          VK_KHR_16BIT_STORAGE_EXTENSION_NAME,
-          VK_KHR_8BIT_STORAGE_EXTENSION_NAME,
-        };
+void startTrace()
+{
+    traceEnabled = true;
+    traceThreadName("main");
+}
 
-        VkPhysicalDeviceFeatures deviceFeatures = {};
-        deviceFeatures.samplerAnisotropy = VK_TRUE;
+// must only be called once every traced thread is done
+void writeTrace(const char* path)
+{
+    traceEnabled = false;
 
-        //VkPhysicalDevice16BitStorageFeatures features16 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_16BIT_STORAGE_FEATURES };
-        //features16.storageBuffer16BitAccess = true;
+    FILE* file = fopen(path, "w");
+    if (!file)
+    {
+        std::cout << "Can't write trace " << path << std::endl;
+        return;
+    }
 
-        //VkPhysicalDevice8BitStorageFeatures features8 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_8BIT_STORAGE_FEATURES };
-        //features8.storageBuffer8BitAccess = true;
+    uint64_t start = ~0ull;
+    size_t eventCount = 0;
 
-        VkPhysicalDeviceVulkan12Features features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
-        features.shaderInt8 = true;
-        features.uniformAndStorageBuffer8BitAccess = true;
+    for (TraceBuffer* buffer = traceBuffers; buffer; buffer = buffer->next)
+        for (const TraceEvent& event : buffer->events)
+            start = std::min(start, event.begin);
 
-        VkDeviceCreateInfo createInfo = { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO };
-        createInfo.queueCreateInfoCount = 1;
-        createInfo.pQueueCreateInfos = &queueInfo;
-        createInfo.ppEnabledExtensionNames = extensions.data();
-        createInfo.enabledExtensionCount = uint32_t(extensions.size());
-        createInfo.pEnabledFeatures = &deviceFeatures;
-        createInfo.pNext = &features;//&features16;
-        //features16.pNext = &features8;
+    // complete events with microsecond timestamps relative to the first zone
+    fprintf(file, "{\"traceEvents\":[\n");
 
-        // might need to enable feature for read-write buffers in shaders (vertexPipelineStoresAndAtomics) 
+    bool first = true;
 
-        VK_CHECK(vkCreateDevice(physicalDevice, &createInfo, nullptr, &device));
+    for (TraceBuffer* buffer = traceBuffers; buffer; buffer = buffer->next)
+    {
+        if (buffer->threadName)
+        {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", buffer->threadId, buffer->threadName);
+            first = false;
+        }
+
+        for (const TraceEvent& event : buffer->events)
+        {
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", first ? "" : ",\n",
+                event.name, buffer->threadId, double(event.begin - start) * 1e-3, double(event.end - event.begin) * 1e-3);
+            first = false;
+        }
+
+        eventCount += buffer->events.size();
     }
 
-    void CreateSurface()
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    printf("Wrote %zu trace zones from %u threads to %s\n", eventCount, traceThreadCount.load(), path);
+
+    while (TraceBuffer* buffer = traceBuffers)
     {
-#ifdef VK_USE_PLATFORM_WIN32_KHR
-        VkWin32SurfaceCreateInfoKHR createInfo = { VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR };
-        createInfo.hinstance = GetModuleHandle(0);
-        createInfo.hwnd = glfwGetWin32Window(window);
+        traceBuffers = buffer->next;
+        delete buffer;
+    }
+}
 
-        VK_CHECK(vkCreateWin32SurfaceKHR(instance, &createInfo, 0, &surface));
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+// TRACE_ZONE times the rest of the enclosing scope, TRACE_BEGIN/TRACE_END time a range within one scope
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+#define TRACE_BEGIN(zone, name) TraceZone zone(name)
+#define TRACE_END(zone) zone.End()
+#define TRACE_THREAD_NAME(name) traceThreadName(name)
 #else
-#error Unsupported Platforms
+#define TRACE_ZONE(name) ((void)0)
+#define TRACE_BEGIN(zone, name) ((void)0)
+#define TRACE_END(zone) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
 #endif
-    }
 
-    void GetSwapchainFormat()
+// threads that are kept around for work that runs every frame or in several parallel steps, where starting threads per step would cost more than the work
+struct ThreadPool
+{
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+
+    const std::function<void(uint32_t)>* task = nullptr;
+    uint32_t taskCount = 0;
+    uint32_t generation = 0;
+    uint32_t remaining = 0;
+    bool stopping = false;
+
+    // the first exception thrown by a worker in the current run, rethrown on the calling thread
+    std::exception_ptr error;
+
+    // joins the workers if the owner unwinds without destroyThreadPool
+    ~ThreadPool();
+};
+
+void threadPoolWorker(ThreadPool& pool, uint32_t index, const char* name)
+{
+    TRACE_THREAD_NAME(name);
+    (void)name;
+
+    uint32_t generation = 0;
+
+    for (;;)
     {
-        uint32_t formatCount = 0;
-        VK_CHECK(vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, 0));
-        std::vector<VkSurfaceFormatKHR> formats(formatCount);
-        VK_CHECK(vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, formats.data()));
+        const std::function<void(uint32_t)>* task = nullptr;
+        uint32_t taskCount = 0;
 
-        // special case where if the only format supported is undefined that means any format is supported
-        if (formatCount == 1 && formats[0].format == VK_FORMAT_UNDEFINED)
         {
-            swapchainFormat = VK_FORMAT_R8G8B8A8_UNORM;
-            return;
+            std::unique_lock<std::mutex> lock(pool.mutex);
+            pool.start.wait(lock, [&]() { return pool.stopping || pool.generation != generation; });
+
+            if (pool.stopping)
+                return;
+
+            generation = pool.generation;
+            task = pool.task;
+            taskCount = pool.taskCount;
         }
 
-        // give preference to 32 bit formats
-        for (uint32_t i = 0; i < formatCount; ++i)
+        std::exception_ptr error;
+
+        // thread i runs task i + 1, task 0 runs on the calling thread
+        try
         {
-            if (formats[i].format == VK_FORMAT_R8G8B8A8_UNORM || formats[i].format == VK_FORMAT_B8G8R8A8_UNORM)
-            {
-                swapchainFormat = formats[i].format;
-                return;
-            }
+            if (index + 1 < taskCount)
+                (*task)(index + 1);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
         }
 
-        swapchainFormat = formats[0].format;
+        {
+            std::lock_guard<std::mutex> lock(pool.mutex);
+
+            if (error && !pool.error)
+                pool.error = error;
+
+            if (--pool.remaining == 0)
+                pool.done.notify_one();
+        }
     }
+}
 
-    VkSwapchainKHR CreateSwapchain(uint32_t width, uint32_t height, VkSwapchainKHR oldSwapchain = 0)
+// name must outlive the pool, it is only used to label the threads in traces
+void createThreadPool(ThreadPool& pool, uint32_t threadCount, const char* name)
+{
+    for (uint32_t i = 0; i < threadCount; ++i)
+        pool.threads.emplace_back(threadPoolWorker, std::ref(pool), i, name);
+}
+
+void destroyThreadPool(ThreadPool& pool)
+{
     {
-        // get surface capabilities before creating swapchain
-        VkSurfaceCapabilitiesKHR surfaceCap;
-        VK_CHECK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCap));
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.stopping = true;
+    }
 
-        // Not all alpha composites are supported on all platforms so it is important to read from the surface caps
-        VkCompositeAlphaFlagBitsKHR surfaceComposite = (surfaceCap.supportedCompositeAlpha & VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR)
-            ? VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR
-            : (surfaceCap.supportedCompositeAlpha & VK_COMPOSITE_ALPHA_PRE_MULTIPLIED_BIT_KHR)
-            ? VK_COMPOSITE_ALPHA_PRE_MULTIPLIED_BIT_KHR
-            : (surfaceCap.supportedCompositeAlpha & VK_COMPOSITE_ALPHA_POST_MULTIPLIED_BIT_KHR)
-            ? VK_COMPOSITE_ALPHA_POST_MULTIPLIED_BIT_KHR
-            : VK_COMPOSITE_ALPHA_INHERIT_BIT_KHR;
+    pool.start.notify_all();
 
-        VkBool32 isSupported = 0;
-        VK_CHECK(vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, queueFamilyIndex, surface, &isSupported));
+    for (std::thread& thread : pool.threads)
+        thread.join();
 
-        if (isSupported == VK_FALSE)
-            throw std::runtime_error("Surface does not support presentation");
+    pool.threads.clear();
+}
 
-        VkSwapchainCreateInfoKHR createInfo = { VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR };
-        createInfo.surface = surface;
-        createInfo.minImageCount = std::max(2u, surfaceCap.minImageCount); // double buffered at min
-        createInfo.imageFormat = swapchainFormat;
-        createInfo.imageColorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
-        createInfo.imageExtent.width = width;
-        createInfo.imageExtent.height = height;
-        createInfo.imageArrayLayers = 1;
-        createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-        createInfo.queueFamilyIndexCount = 1;
-        createInfo.pQueueFamilyIndices = &queueFamilyIndex;
-        createInfo.presentMode = VK_PRESENT_MODE_FIFO_KHR;
-        createInfo.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
-        createInfo.compositeAlpha = surfaceComposite;
-        createInfo.presentMode = VK_PRESENT_MODE_FIFO_KHR;
-        createInfo.oldSwapchain = oldSwapchain;
-
-        VkSwapchainKHR swapchain = 0;
-        VK_CHECK(vkCreateSwapchainKHR(device, &createInfo, 0, &swapchain));
+ThreadPool::~ThreadPool()
+{
+    destroyThreadPool(*this);
+}
 
-        return swapchain;
+// runs task(0) .. task(count - 1) on the pool's threads, task(0) runs on the calling thread, count must be at most the thread count + 1
+void runThreadPool(ThreadPool& pool, uint32_t count, const std::function<void(uint32_t)>& task)
+{
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.task = &task;
+        pool.taskCount = count;
+        pool.remaining = uint32_t(pool.threads.size());
+        pool.error = nullptr;
+        pool.generation++;
     }
 
-    struct Swapchain
+    pool.start.notify_all();
+
+    // the workers reference task until they are done, so a throwing task(0) still waits for them before unwinding
+    std::exception_ptr error;
+
+    try
     {
-        VkSwapchainKHR swapchain;
+        if (count > 0)
+            task(0);
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
 
-        std::vector<VkImage> images;
-        std::vector<VkImageView> imageViews;
-        std::vector<VkFramebuffer> framebuffers;
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    pool.done.wait(lock, [&]() { return pool.remaining == 0; });
 
-        uint32_t width, height;
-        uint32_t imageCount;
+    if (!error)
+        error = pool.error;
+
+    pool.error = nullptr;
+    lock.unlock();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// peak resident set size of the process in bytes
+size_t getPeakMemoryUsage()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters = {};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+
+    return 0;
+#else
+    struct rusage usage = {};
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        return size_t(usage.ru_maxrss) * 1024; // reported in kilobytes on linux
+
+    return 0;
+#endif
+}
+
+// minimal OBJ tokenizing used by the parallel parser, everything works on [p, end) of a mapped file
+
+inline const char* objSkipSpace(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        ++p;
+
+    return p;
+}
+
+inline const char* objSkipLine(const char* p, const char* end)
+{
+    while (p < end && *p != '\n')
+        ++p;
+
+    return p < end ? p + 1 : end;
+}
+
+inline bool objIsDigit(char c)
+{
+    return unsigned(c - '0') < 10;
+}
+
+// handles the decimal and exponent notation written by exporters, locale independent and much faster than strtof
+inline const char* objParseFloat(const char* p, const char* end, float& result)
+{
+    static const double powers[] =
+    {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
     };
 
-    bool CreateSwapchain(Swapchain& result, uint32_t width, uint32_t height, VkSwapchainKHR old = 0)
+    p = objSkipSpace(p, end);
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    // mantissa keeps at most 17 significant digits, which is all a double can represent anyway
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+
+    for (; p < end && objIsDigit(*p); ++p)
     {
-        VkSwapchainKHR swapchain = CreateSwapchain(width, height, old);
+        if (digits < 17)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa != 0;
+        }
+        else
+            exponent++;
+    }
 
-        if (!swapchain)
-            return false;
+    if (p < end && *p == '.')
+    {
+        for (++p; p < end && objIsDigit(*p); ++p)
+        {
+            if (digits < 17)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa != 0;
+                exponent--;
+            }
+        }
+    }
 
-        uint32_t imageCount = 0;
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        ++p;
 
-        VK_CHECK(vkGetSwapchainImagesKHR(device, swapchain, &imageCount, 0));
-        std::vector<VkImage> swapchainImages(imageCount);
-        VK_CHECK(vkGetSwapchainImagesKHR(device, swapchain, &imageCount, swapchainImages.data()));
+        bool exponentNegative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            exponentNegative = *p++ == '-';
 
-        std::vector<VkImageView> swapchainImageViews(imageCount);
-        for (uint32_t i = 0; i < imageCount; ++i)
-            swapchainImageViews[i] = CreateImageView(swapchainImages[i], swapchainFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+        int value = 0;
+        for (; p < end && objIsDigit(*p); ++p)
+            value = std::min(value * 10 + (*p - '0'), 1000);
 
-        std::vector<VkFramebuffer> swapchainFramebuffers(imageCount);
-        for (uint32_t i = 0; i < imageCount; ++i)
-            swapchainFramebuffers[i] = CreateFramebuffer(swapchainImageViews[i], width, height);
+        exponent += exponentNegative ? -value : value;
+    }
 
-        result.swapchain = swapchain;
-        result.imageCount = imageCount;
-        result.width = width;
-        result.height = height;
-        result.images = swapchainImages;
-        result.imageViews = swapchainImageViews;
-        result.framebuffers = swapchainFramebuffers;
+    double value = double(mantissa);
 
-        return true;
+    if (exponent < 0)
+        value = exponent >= -22 ? value / powers[-exponent] : value * pow(10.0, exponent);
+    else if (exponent > 0)
+        value = exponent <= 22 ? value * powers[exponent] : value * pow(10.0, exponent);
+
+    result = float(negative ? -value : value);
+
+    return p;
+}
+
+// returns p unchanged when there is no number to parse
+inline const char* objParseInt(const char* p, const char* end, int64_t& result)
+{
+    const char* begin = p;
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    if (p == end || !objIsDigit(*p))
+        return begin;
+
+    int64_t value = 0;
+    for (; p < end && objIsDigit(*p); ++p)
+        value = value * 10 + (*p - '0');
+
+    result = negative ? -value : value;
+
+    return p;
+}
+
+// OBJ indices are 1-based, negative values are relative to the attributes defined so far, 0 means the attribute is missing
+// returns -2 for indices out of range
+inline int32_t objResolveIndex(int64_t index, size_t definedCount, size_t totalCount)
+{
+    if (index > 0)
+        return index <= int64_t(totalCount) ? int32_t(index - 1) : -2;
+    if (index < 0)
+        return -index <= int64_t(definedCount) ? int32_t(int64_t(definedCount) + index) : -2;
+
+    return -1;
+}
+
+struct Options
+{
+    // headless renders into an offscreen target without a window or swapchain, e.g. on lavapipe/SwiftShader
+    bool headless = false;
+    // number of frames to render once loading finished before exiting, 0 runs until the window is closed
+    uint32_t frameCount = 0;
+    uint32_t width = 1024;
+    uint32_t height = 768;
+    // frames the cpu may record ahead of the gpu, 1 serializes cpu and gpu work
+    uint32_t framesInFlight = 2;
+    // reuse processed meshes from a binary cache file next to each source mesh
+    bool meshCache = true;
+    // parse OBJ files with the chunked multithreaded parser instead of tinyobjloader
+    bool parallelObjParser = true;
+    // reorder indices and vertices for vertex cache, overdraw and vertex fetch efficiency after loading
+    bool optimizeMeshes = false;
+    // 12 byte vertices with unorm16 positions, octahedral normals and half uvs, 16 bit indices when possible
+    bool quantizeMeshes = false;
+    // split meshes into meshlets and cull them on the gpu every frame before rasterization
+    bool meshlets = false;
+    // draw meshlets with task/mesh shaders when VK_EXT_mesh_shader is available, otherwise compact an index buffer in compute
+    bool meshShading = true;
+    // number of copies of the mesh laid out on a grid
+    uint32_t objectCount = 1;
+    // cull objects in a compute pass and draw the survivors with vkCmdDrawIndexedIndirectCount instead of a draw call per object
+    bool gpuDriven = false;
+    // also cull gpu driven objects hidden behind the depth of last frame's visible objects, implies gpuDriven
+    bool occlusion = false;
+    // draw all objects with one instanced vkCmdDrawIndexed, without culling
+    bool instanced = false;
+    // build a chain of simplified index ranges per mesh and pick one per object from its projected error
+    bool lods = false;
+    // simplification error allowed per lod step, relative to the mesh extent
+    float lodError = 0.02f;
+    // largest projected lod error in pixels that is accepted
+    float lodThreshold = 1.0f;
+    // upload on a transfer only queue family when the device has one
+    bool transferQueue = true;
+    // give textures a full mip chain generated on the gpu and sample them trilinearly with anisotropic filtering
+    bool mips = true;
+    // prefer a block compressed .ktx2 file next to each texture over decoding the original image
+    bool ktx2 = true;
+    // worker threads that load assets while frames render, 0 loads everything on the main thread before the first frame
+    uint32_t loaderThreads = 4;
+    // write a chrome trace of the cpu zones to this file at exit
+    const char* tracePath = nullptr;
+    // seed the pipeline cache from the file written by the previous run and save it back
+    bool pipelineCache = true;
+    // threads that record the per object draw calls into secondary command buffers, 0 uses every core
+    uint32_t recordThreads = 1;
+    // collect pipeline statistics, log rolling gpu scope timings and write them to gpu_profile.json at exit
+    bool gpuProfile = false;
+    // requested present mode, falls back to a supported mode with similar latency
+    VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+    // swapchain images to request, 0 picks 2 (3 for mailbox) within the surface limits
+    uint32_t swapchainImages = 0;
+    // render frameCount frames uncapped once loading finished and report fps with 1% and 0.1% lows
+    bool benchmark = false;
+};
+
+// recursive so it stays a single return C++11 constexpr function
+constexpr uint32_t countBits(uint32_t value)
+{
+    return value ? (value & 1) + countBits(value >> 1) : 0;
+}
+
+const char* presentModeName(VkPresentModeKHR mode)
+{
+    switch (mode)
+    {
+    case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+    case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+    case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+    case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo-relaxed";
+    default: return "unknown";
     }
+}
 
-    void ResizeSwapchain(Swapchain& swapchain, uint32_t width, uint32_t height)
+Options parseOptions(int argc, char** argv)
+{
+    Options options;
+    bool presentModeSet = false;
+
+    for (int i = 1; i < argc; ++i)
     {
-        Swapchain oldSwapchain = swapchain;
+        if (strcmp(argv[i], "--headless") == 0)
+            options.headless = true;
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            options.frameCount = uint32_t(atoi(argv[++i]));
+        else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc)
+            options.framesInFlight = uint32_t(atoi(argv[++i]));
+        else if (strcmp(argv[i], "--no-mesh-cache") == 0)
+            options.meshCache = false;
+        else if (strcmp(argv[i], "--optimize-meshes") == 0)
+            options.optimizeMeshes = true;
+        else if (strcmp(argv[i], "--quantize-meshes") == 0)
+            options.quantizeMeshes = true;
+        else if (strcmp(argv[i], "--meshlets") == 0)
+            options.meshlets = true;
+        else if (strcmp(argv[i], "--no-mesh-shading") == 0)
+            options.meshShading = false;
+        else if (strcmp(argv[i], "--objects") == 0 && i + 1 < argc)
+            options.objectCount = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--gpu-driven") == 0)
+            options.gpuDriven = true;
+        else if (strcmp(argv[i], "--occlusion") == 0)
+            options.gpuDriven = options.occlusion = true;
+        else if (strcmp(argv[i], "--instanced") == 0)
+            options.instanced = true;
+        else if (strcmp(argv[i], "--lods") == 0)
+            options.lods = true;
+        else if (strcmp(argv[i], "--lod-error") == 0 && i + 1 < argc)
+            options.lodError = float(atof(argv[++i]));
+        else if (strcmp(argv[i], "--lod-threshold") == 0 && i + 1 < argc)
+            options.lodThreshold = std::max(float(atof(argv[++i])), 1e-3f);
+        else if (strcmp(argv[i], "--no-transfer-queue") == 0)
+            options.transferQueue = false;
+        else if (strcmp(argv[i], "--no-mips") == 0)
+            options.mips = false;
+        else if (strcmp(argv[i], "--no-ktx2") == 0)
+            options.ktx2 = false;
+        else if (strcmp(argv[i], "--present-mode") == 0 && i + 1 < argc)
+        {
+            const char* mode = argv[++i];
+
+            if (strcmp(mode, "fifo") == 0)
+                options.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+            else if (strcmp(mode, "fifo-relaxed") == 0)
+                options.presentMode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+            else if (strcmp(mode, "mailbox") == 0)
+                options.presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+            else if (strcmp(mode, "immediate") == 0)
+                options.presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+            else
+                throw std::runtime_error(std::string("Unknown present mode: ") + mode);
+
+            presentModeSet = true;
+        }
+        else if (strcmp(argv[i], "--swapchain-images") == 0 && i + 1 < argc)
+            options.swapchainImages = uint32_t(std::max(0, atoi(argv[++i])));
+        else if (strcmp(argv[i], "--benchmark") == 0)
+            options.benchmark = true;
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            options.tracePath = argv[++i];
+        else if (strcmp(argv[i], "--gpu-profile") == 0)
+            options.gpuProfile = true;
+        else if (strcmp(argv[i], "--record-threads") == 0 && i + 1 < argc)
+            options.recordThreads = uint32_t(std::max(0, atoi(argv[++i])));
+        else if (strcmp(argv[i], "--no-pipeline-cache") == 0)
+            options.pipelineCache = false;
+        else if (strcmp(argv[i], "--loader-threads") == 0 && i + 1 < argc)
+            options.loaderThreads = uint32_t(std::max(0, atoi(argv[++i])));
+        else if (strcmp(argv[i], "--obj-parser") == 0 && i + 1 < argc)
+        {
+            const char* parser = argv[++i];
+
+            if (strcmp(parser, "parallel") == 0)
+                options.parallelObjParser = true;
+            else if (strcmp(parser, "tinyobj") == 0)
+                options.parallelObjParser = false;
+            else
+                throw std::runtime_error(std::string("Unknown OBJ parser: ") + parser);
+        }
+        else if (strcmp(argv[i], "--width") == 0 && i + 1 < argc)
+            options.width = uint32_t(atoi(argv[++i]));
+        else if (strcmp(argv[i], "--height") == 0 && i + 1 < argc)
+            options.height = uint32_t(atoi(argv[++i]));
+        else
+            throw std::runtime_error(std::string("Unknown argument: ") + argv[i]);
+    }
 
-        CreateSwapchain(this->swapchain, width, height, oldSwapchain.swapchain);
+    // benchmarks don't wait for vblank unless a present mode was asked for
+    if (options.benchmark && !presentModeSet)
+        options.presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
 
-        VK_CHECK(vkDeviceWaitIdle(device));
+    if (options.benchmark && options.frameCount == 0)
+        options.frameCount = 1000;
+
+    // there is no window to close in headless mode so always stop eventually
+    if (options.headless && options.frameCount == 0)
+        options.frameCount = 100;
+
+    if (options.framesInFlight == 0)
+        throw std::runtime_error("At least one frame in flight is required");
+
+    if (options.recordThreads == 0)
+        options.recordThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    if (options.width == 0 || options.height == 0)
+        throw std::runtime_error("Render target size must be non-zero");
+
+    return options;
+}
+
+// Write code first and as it becomes painful to deal with make it less painful to deal with
+// Semantic Compression by Casey Muratori
 
-        // TODO: this is a bit weird... fix it
-        DestroySwapchain(oldSwapchain);
+class HelloTriangleApplication
+{
+public:
+    explicit HelloTriangleApplication(const Options& options)
+        : options(options)
+    {
     }
 
-    void DestroySwapchain(Swapchain& swapchain)
+    void Run()
     {
-        for (uint32_t i = 0; i < swapchain.imageCount; ++i)
-            vkDestroyFramebuffer(device, swapchain.framebuffers[i], 0);
+        if (!options.headless)
+            InitWindow();
 
-        for (uint32_t i = 0; i < swapchain.imageCount; ++i)
-            vkDestroyImageView(device, swapchain.imageViews[i], 0);
+        InitVulkan();
+        MainLoop();
+        Cleanup();
+    }
 
-        vkDestroySwapchainKHR(device, swapchain.swapchain, 0);
+private:
+    void InitWindow()
+    {
+        glfwInit();
+
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API); // tell glfw to not create opengl context by default
+        glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+
+        window = glfwCreateWindow(int(options.width), int(options.height), "Vulkan", nullptr, nullptr);
+
+        if (!window)
+            throw std::runtime_error("GLFW couldn't create window");
     }
 
-    void DebugExtensionSupport()
+    void InitVulkan()
     {
-        // Details of extensions supported
+        TRACE_ZONE("InitVulkan");
+
+        VK_CHECK(volkInitialize());
+
+        CreateInstance();
+        //DebugExtensionSupport();
+        
+        volkLoadInstance(instance);
+
+        // Set Debug Callback for Validation Errors
+        if (debugReportSupported)
+            debugMessenger = registerDebugCallback(instance);
+
+        CreatePhysicalAndLogicalDevice();
+
+        if (!options.headless)
+            CreateSurface();
+
+        CreateFrames();
+    }
+
+    bool SupportsPresentation(VkPhysicalDevice pd, uint32_t familyIndex)
+    {
+        // there is nothing to present to in headless mode, any graphics queue will do
+        if (options.headless)
+            return true;
+
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+        return vkGetPhysicalDeviceWin32PresentationSupportKHR(pd, familyIndex) == VK_TRUE;
+#else
+        return glfwGetPhysicalDevicePresentationSupport(instance, pd, familyIndex) == GLFW_TRUE;
+#endif
+    }
+
+    VkPhysicalDevice PickPhysicalDevice(std::vector<VkPhysicalDevice>& pd, uint32_t pdc)
+    {
+        for (uint32_t i = 0; i < pdc; ++i)
+        {
+            VkPhysicalDeviceProperties props;
+            vkGetPhysicalDeviceProperties(pd[i], &props);
+
+            // rendering relies on dynamic rendering and synchronization2, which every vulkan 1.3 device supports
+            if (props.apiVersion < VK_API_VERSION_1_3)
+                continue;
+
+            queueFamilyIndex = GetGraphicsQueueFamily(pd[i]);
+
+            if (queueFamilyIndex == VK_QUEUE_FAMILY_IGNORED)
+                continue;
+
+            // check for presentation support on the device
+            if (!SupportsPresentation(pd[i], queueFamilyIndex))
+                continue;
+
+            if (props.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
+            {
+                std::cout << "Picking discrete GPU " << props.deviceName << std::endl;
+                return pd[i];
+            }
+        }
+
+        // return the first device if no discrete gpu found, e.g. software rasterizers like lavapipe report a CPU device type
+        VkPhysicalDeviceProperties props = {};
+
+        if (pdc > 0)
+        {
+            vkGetPhysicalDeviceProperties(pd[0], &props);
+            queueFamilyIndex = GetGraphicsQueueFamily(pd[0]);
+        }
+
+        if (pdc > 0 && props.apiVersion >= VK_API_VERSION_1_3 && queueFamilyIndex != VK_QUEUE_FAMILY_IGNORED && SupportsPresentation(pd[0], queueFamilyIndex))
+        {
+            std::cout << "Picking fallback GPU " << props.deviceName << std::endl;
+            return pd[0];
+        }
+
+        std::cout << "No physical devices available!" << std::endl;
+        return VK_NULL_HANDLE;
+    }
+
+
+    void CreateInstance()
+    {
+        // for portability should check if the used api version is available first
+        VkApplicationInfo appInfo{};
+        appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+        appInfo.pApplicationName = "MyFirstVulkanTriangle";
+        appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+        appInfo.pEngineName = "No Engine";
+        appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+        appInfo.apiVersion = VK_API_VERSION_1_3;
+
+        VkInstanceCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+        createInfo.pApplicationInfo = &appInfo;
+
+
+        std::vector<const char*> extensionNames;
+
+        // get required extensions from GLFW, headless mode doesn't need any surface extensions
+        if (!options.headless)
+        {
+            uint32_t glfwExtensionCount = 0;
+            const char** glfwExtensions;
+
+            glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+            extensionNames.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+        }
+
+        // software drivers don't always expose debug report so only request it when available
         uint32_t extensionCount = 0;
+        VK_CHECK(vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr));
+        std::vector<VkExtensionProperties> extensions(extensionCount);
+        VK_CHECK(vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data()));
+
+        for (const auto& extension : extensions)
+            if (strcmp(extension.extensionName, VK_EXT_DEBUG_REPORT_EXTENSION_NAME) == 0)
+                debugReportSupported = true;
+
+        if (debugReportSupported)
+            extensionNames.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(extensionNames.size());
+        createInfo.ppEnabledExtensionNames = extensionNames.data();
+
+#ifdef _DEBUG
+        const char* debugLayers[] =
+        {
+          "VK_LAYER_KHRONOS_validation"
+        };
+
+        createInfo.ppEnabledLayerNames = debugLayers;
+        createInfo.enabledLayerCount = 1;
+#endif
+
+        VK_CHECK(vkCreateInstance(&createInfo, 0, &instance));
+    }
+
+    uint32_t GetGraphicsQueueFamily(VkPhysicalDevice pd)
+    {
+        // Find a QueueFamily that supports graphics
+        uint32_t queueFamilyCount;
+        vkGetPhysicalDeviceQueueFamilyProperties(pd, &queueFamilyCount, 0);
+        std::vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(pd, &queueFamilyCount, queueFamilyProperties.data());
+
+        for (uint32_t i = 0; i < queueFamilyCount; ++i)
+        {
+            if (queueFamilyProperties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+                return i;
+        }
+
+        // throw std::runtime_error("No queue families support graphics. Is this a compute-only device?");
+
+        return VK_QUEUE_FAMILY_IGNORED;
+    }
+
+    // a family with transfer but neither graphics nor compute usually maps to the dedicated copy engines
+    uint32_t GetTransferQueueFamily(VkPhysicalDevice pd)
+    {
+        uint32_t queueFamilyCount;
+        vkGetPhysicalDeviceQueueFamilyProperties(pd, &queueFamilyCount, 0);
+        std::vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(pd, &queueFamilyCount, queueFamilyProperties.data());
+
+        for (uint32_t i = 0; i < queueFamilyCount; ++i)
+        {
+            VkQueueFlags flags = queueFamilyProperties[i].queueFlags;
+
+            if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+                return i;
+        }
+
+        return VK_QUEUE_FAMILY_IGNORED;
+    }
+
+    bool IsDeviceExtensionSupported(VkPhysicalDevice pd, const char* name)
+    {
+        uint32_t extensionCount = 0;
+        VK_CHECK(vkEnumerateDeviceExtensionProperties(pd, 0, &extensionCount, 0));
+        std::vector<VkExtensionProperties> extensionProperties(extensionCount);
+        VK_CHECK(vkEnumerateDeviceExtensionProperties(pd, 0, &extensionCount, extensionProperties.data()));
+
+        for (const VkExtensionProperties& extension : extensionProperties)
+            if (strcmp(extension.extensionName, name) == 0)
+                return true;
+
+        return false;
+    }
+
+    void CreatePhysicalAndLogicalDevice()
+    {
+        uint32_t deviceCount;
+        VK_CHECK(vkEnumeratePhysicalDevices(instance, &deviceCount, 0));
+        std::vector<VkPhysicalDevice> physicalDevices(deviceCount);
+        VK_CHECK(vkEnumeratePhysicalDevices(instance, &deviceCount, physicalDevices.data()));
+
+        physicalDevice = PickPhysicalDevice(physicalDevices, deviceCount);
+        if (physicalDevice == VK_NULL_HANDLE)
+            throw std::runtime_error("Abort! No Vulkan device found.");
+
+        float queuePriorities[] = { 1.0f };
+
+        VkDeviceQueueCreateInfo queueInfos[2] = {};
+        uint32_t queueInfoCount = 0;
+
+        queueInfos[queueInfoCount].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queueInfos[queueInfoCount].queueFamilyIndex = queueFamilyIndex;
+        queueInfos[queueInfoCount].queueCount = 1;
+        queueInfos[queueInfoCount].pQueuePriorities = queuePriorities;
+        queueInfoCount++;
+
+        // uploads share the graphics queue when there is no transfer only family
+        transferQueueFamilyIndex = options.transferQueue ? GetTransferQueueFamily(physicalDevice) : VK_QUEUE_FAMILY_IGNORED;
+
+        if (transferQueueFamilyIndex != VK_QUEUE_FAMILY_IGNORED)
+        {
+            queueInfos[queueInfoCount].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+            queueInfos[queueInfoCount].queueFamilyIndex = transferQueueFamilyIndex;
+            queueInfos[queueInfoCount].queueCount = 1;
+            queueInfos[queueInfoCount].pQueuePriorities = queuePriorities;
+            queueInfoCount++;
+
+            printf("Uploading on transfer queue family %u\n", transferQueueFamilyIndex);
+        }
+        else
+        {
+            transferQueueFamilyIndex = queueFamilyIndex;
+        }
+
+        std::vector<const char*> extensions =
+        {
+          VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME,
+          VK_KHR_16BIT_STORAGE_EXTENSION_NAME,
+          VK_KHR_8BIT_STORAGE_EXTENSION_NAME,
+        };
+
+        if (!options.headless)
+            extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(physicalDevice, &props);
+
+        // timestampPeriod is the number of nanoseconds per timestamp tick
+        timestampPeriod = props.limits.timestampPeriod;
+
+        // every frame is timed on the graphics queue, which needs timestamps on its family
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, 0);
+        std::vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilyProperties.data());
+
+        uint32_t timestampValidBits = queueFamilyProperties[queueFamilyIndex].timestampValidBits;
+
+        if (timestampValidBits == 0)
+            throw std::runtime_error("The graphics queue doesn't support timestamps");
+
+        timestampMask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+
+        VkPhysicalDeviceFeatures deviceFeatures = {};
+
+        //VkPhysicalDevice16BitStorageFeatures features16 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_16BIT_STORAGE_FEATURES };
+        //features16.storageBuffer16BitAccess = true;
+
+        //VkPhysicalDevice8BitStorageFeatures features8 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_8BIT_STORAGE_FEATURES };
+        //features8.storageBuffer8BitAccess = true;
+
+        // query optional features so the paths that need them can be disabled on devices without them
+        VkPhysicalDeviceVulkan11Features supported11 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES };
+        VkPhysicalDeviceVulkan12Features supported12 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+        VkPhysicalDeviceVulkan13Features supported13 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES };
+        VkPhysicalDeviceMeshShaderFeaturesEXT supportedMesh = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT };
+
+        VkPhysicalDeviceFeatures2 supported = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+        supported.pNext = &supported11;
+        supported11.pNext = &supported12;
+        supported12.pNext = &supported13;
+
+        // the mesh shader feature struct may only be chained when the extension exists
+        bool meshShaderExtension = options.meshlets && options.meshShading && IsDeviceExtensionSupported(physicalDevice, VK_EXT_MESH_SHADER_EXTENSION_NAME);
+
+        if (meshShaderExtension)
+            supported13.pNext = &supportedMesh;
+
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &supported);
+
+        if (!supported13.dynamicRendering || !supported13.synchronization2)
+            throw std::runtime_error("Device doesn't support dynamicRendering and synchronization2");
+
+        deviceFeatures.samplerAnisotropy = supported.features.samplerAnisotropy;
+
+        // compressed formats are only reported as sampleable once these are enabled, LoadKtx2 checks the format properties
+        deviceFeatures.textureCompressionBC = supported.features.textureCompressionBC;
+        deviceFeatures.textureCompressionETC2 = supported.features.textureCompressionETC2;
+        maxSamplerAnisotropy = supported.features.samplerAnisotropy ? props.limits.maxSamplerAnisotropy : 1.0f;
+
+        // statistics queries stay active while the secondary command buffers of --record-threads execute only with inheritedQueries
+        deviceFeatures.pipelineStatisticsQuery = supported.features.pipelineStatisticsQuery;
+        deviceFeatures.inheritedQueries = supported.features.inheritedQueries;
+        pipelineStatisticsSupported = supported.features.pipelineStatisticsQuery == VK_TRUE;
+        inheritedQueriesSupported = supported.features.inheritedQueries == VK_TRUE;
+
+        storage16BitSupported = supported11.storageBuffer16BitAccess == VK_TRUE;
+        meshShadingSupported = meshShaderExtension && supportedMesh.taskShader && supportedMesh.meshShader;
+        drawIndirectCountSupported = supported12.drawIndirectCount && supported.features.drawIndirectFirstInstance && supported.features.multiDrawIndirect;
+
+        if (meshShadingSupported)
+            extensions.push_back(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+
+        VkPhysicalDeviceVulkan11Features features11 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES };
+        features11.storageBuffer16BitAccess = storage16BitSupported;
+
+        VkPhysicalDeviceVulkan12Features features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+        features.shaderInt8 = true;
+        features.uniformAndStorageBuffer8BitAccess = true;
+        features.drawIndirectCount = drawIndirectCountSupported;
+
+        // instances pick their texture from an array, the index can differ between invocations of one draw
+        features.shaderSampledImageArrayNonUniformIndexing = supported12.shaderSampledImageArrayNonUniformIndexing;
+        deviceFeatures.shaderSampledImageArrayDynamicIndexing = supported.features.shaderSampledImageArrayDynamicIndexing;
+
+        deviceFeatures.drawIndirectFirstInstance = drawIndirectCountSupported;
+        deviceFeatures.multiDrawIndirect = drawIndirectCountSupported;
+
+        // frames render with vkCmdBeginRendering instead of render pass and framebuffer objects
+        VkPhysicalDeviceVulkan13Features features13 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES };
+        features13.dynamicRendering = true;
+        features13.synchronization2 = true;
+
+        VkPhysicalDeviceMeshShaderFeaturesEXT featuresMesh = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT };
+        featuresMesh.taskShader = true;
+        featuresMesh.meshShader = true;
+
+        VkDeviceCreateInfo createInfo = { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO };
+        createInfo.queueCreateInfoCount = queueInfoCount;
+        createInfo.pQueueCreateInfos = queueInfos;
+        createInfo.ppEnabledExtensionNames = extensions.data();
+        createInfo.enabledExtensionCount = uint32_t(extensions.size());
+        createInfo.pEnabledFeatures = &deviceFeatures;
+        createInfo.pNext = &features11;
+        features11.pNext = &features;
+        features.pNext = &features13;
+
+        if (meshShadingSupported)
+            features13.pNext = &featuresMesh;
+
+        // might need to enable feature for read-write buffers in shaders (vertexPipelineStoresAndAtomics) 
+
+        VK_CHECK(vkCreateDevice(physicalDevice, &createInfo, nullptr, &device));
+    }
+
+    void CreateSurface()
+    {
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+        VkWin32SurfaceCreateInfoKHR createInfo = { VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR };
+        createInfo.hinstance = GetModuleHandle(0);
+        createInfo.hwnd = glfwGetWin32Window(window);
+
+        VK_CHECK(vkCreateWin32SurfaceKHR(instance, &createInfo, 0, &surface));
+#else
+        VK_CHECK(glfwCreateWindowSurface(instance, window, 0, &surface));
+#endif
+    }
+
+    void GetSwapchainFormat()
+    {
+        uint32_t formatCount = 0;
+        VK_CHECK(vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, 0));
+        std::vector<VkSurfaceFormatKHR> formats(formatCount);
+        VK_CHECK(vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, formats.data()));
+
+        // special case where if the only format supported is undefined that means any format is supported
+        if (formatCount == 1 && formats[0].format == VK_FORMAT_UNDEFINED)
+        {
+            swapchainFormat = VK_FORMAT_R8G8B8A8_UNORM;
+            return;
+        }
+
+        // give preference to 32 bit formats
+        for (uint32_t i = 0; i < formatCount; ++i)
+        {
+            if (formats[i].format == VK_FORMAT_R8G8B8A8_UNORM || formats[i].format == VK_FORMAT_B8G8R8A8_UNORM)
+            {
+                swapchainFormat = formats[i].format;
+                return;
+            }
+        }
+
+        swapchainFormat = formats[0].format;
+    }
+
+    // fifo is the only mode every surface supports, the others fall back to the closest supported mode
+    void GetPresentMode()
+    {
+        uint32_t modeCount = 0;
+        VK_CHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &modeCount, 0));
+        std::vector<VkPresentModeKHR> modes(modeCount);
+        VK_CHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &modeCount, modes.data()));
+
+        VkPresentModeKHR candidates[3] = { options.presentMode, VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR };
+
+        // uncapped modes prefer each other over vsync, relaxed fifo only differs from fifo when a frame is late
+        if (options.presentMode == VK_PRESENT_MODE_IMMEDIATE_KHR)
+            candidates[1] = VK_PRESENT_MODE_MAILBOX_KHR;
+        else if (options.presentMode == VK_PRESENT_MODE_MAILBOX_KHR)
+            candidates[1] = VK_PRESENT_MODE_IMMEDIATE_KHR;
+
+        presentMode = VK_PRESENT_MODE_FIFO_KHR;
+
+        for (VkPresentModeKHR candidate : candidates)
+        {
+            if (std::find(modes.begin(), modes.end(), candidate) != modes.end())
+            {
+                presentMode = candidate;
+                break;
+            }
+        }
+
+        if (presentMode != options.presentMode)
+            printf("Present mode %s is not supported, using %s\n", presentModeName(options.presentMode), presentModeName(presentMode));
+    }
+
+    VkSwapchainKHR CreateSwapchain(uint32_t width, uint32_t height, VkSwapchainKHR oldSwapchain = 0)
+    {
+        // get surface capabilities before creating swapchain
+        VkSurfaceCapabilitiesKHR surfaceCap;
+        VK_CHECK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCap));
+
+        // Not all alpha composites are supported on all platforms so it is important to read from the surface caps
+        VkCompositeAlphaFlagBitsKHR surfaceComposite = (surfaceCap.supportedCompositeAlpha & VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR)
+            ? VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR
+            : (surfaceCap.supportedCompositeAlpha & VK_COMPOSITE_ALPHA_PRE_MULTIPLIED_BIT_KHR)
+            ? VK_COMPOSITE_ALPHA_PRE_MULTIPLIED_BIT_KHR
+            : (surfaceCap.supportedCompositeAlpha & VK_COMPOSITE_ALPHA_POST_MULTIPLIED_BIT_KHR)
+            ? VK_COMPOSITE_ALPHA_POST_MULTIPLIED_BIT_KHR
+            : VK_COMPOSITE_ALPHA_INHERIT_BIT_KHR;
+
+        VkBool32 isSupported = 0;
+        VK_CHECK(vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, queueFamilyIndex, surface, &isSupported));
+
+        if (isSupported == VK_FALSE)
+            throw std::runtime_error("Surface does not support presentation");
+
+        // double buffered at min, mailbox needs a third image to have one to replace while another is presented
+        uint32_t imageCount = options.swapchainImages ? options.swapchainImages : presentMode == VK_PRESENT_MODE_MAILBOX_KHR ? 3 : 2;
+
+        imageCount = std::max(imageCount, surfaceCap.minImageCount);
+
+        // a max of 0 means there is no limit
+        if (surfaceCap.maxImageCount)
+            imageCount = std::min(imageCount, surfaceCap.maxImageCount);
+
+        VkSwapchainCreateInfoKHR createInfo = { VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR };
+        createInfo.surface = surface;
+        createInfo.minImageCount = imageCount;
+        createInfo.imageFormat = swapchainFormat;
+        createInfo.imageColorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
+        createInfo.imageExtent.width = width;
+        createInfo.imageExtent.height = height;
+        createInfo.imageArrayLayers = 1;
+        createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        createInfo.queueFamilyIndexCount = 1;
+        createInfo.pQueueFamilyIndices = &queueFamilyIndex;
+        createInfo.presentMode = presentMode;
+        createInfo.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+        createInfo.compositeAlpha = surfaceComposite;
+        createInfo.oldSwapchain = oldSwapchain;
+
+        VkSwapchainKHR swapchain = 0;
+        VK_CHECK(vkCreateSwapchainKHR(device, &createInfo, 0, &swapchain));
+
+        return swapchain;
+    }
+
+    // device memory of a resource, a range of a shared block or a dedicated VkDeviceMemory
+    struct Allocation
+    {
+        VkDeviceMemory memory;
+        VkDeviceSize offset;
+        VkDeviceSize size; // requested size, the block range is rounded up to a power of two
+        void* data;        // persistent mapping of host visible memory
+        uint32_t block;    // index into memoryAllocator.blocks, ~0u for dedicated allocations
+        uint32_t order;    // block range is kMinAllocationSize << order
+    };
+
+    struct Buffer
+    {
+        VkBuffer buffer;
+        Allocation allocation;
+        void* data;
+        size_t size;
+    };
+
+    struct Image
+    {
+        VkImage image;
+        Allocation allocation;
+
+    };
+
+    struct Swapchain
+    {
+        VkSwapchainKHR swapchain;
+
+        std::vector<VkImage> images;
+        std::vector<VkImageView> imageViews;
+
+        // signaled by the submit that renders an image and waited by its present, one per image because
+        // a frame fence doesn't show that the present's wait has been consumed
+        std::vector<VkSemaphore> releaseSemaphores;
+
+        uint32_t width, height;
+        uint32_t imageCount;
+    };
+
+    bool CreateSwapchain(Swapchain& result, uint32_t width, uint32_t height, VkSwapchainKHR old = 0)
+    {
+        VkSwapchainKHR swapchain = CreateSwapchain(width, height, old);
+
+        if (!swapchain)
+            return false;
+
+        uint32_t imageCount = 0;
+
+        VK_CHECK(vkGetSwapchainImagesKHR(device, swapchain, &imageCount, 0));
+        std::vector<VkImage> swapchainImages(imageCount);
+        VK_CHECK(vkGetSwapchainImagesKHR(device, swapchain, &imageCount, swapchainImages.data()));
+
+        std::vector<VkImageView> swapchainImageViews(imageCount);
+        std::vector<VkSemaphore> releaseSemaphores(imageCount);
+
+        for (uint32_t i = 0; i < imageCount; ++i)
+        {
+            swapchainImageViews[i] = CreateImageView(swapchainImages[i], swapchainFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+            releaseSemaphores[i] = CreateVulkanSemaphore();
+        }
+
+        result.swapchain = swapchain;
+        result.imageCount = imageCount;
+        result.width = width;
+        result.height = height;
+        result.images = swapchainImages;
+        result.imageViews = swapchainImageViews;
+        result.releaseSemaphores = releaseSemaphores;
+
+        return true;
+    }
+
+    // destroy is called once every frame before frameNumber has finished on the gpu
+    struct DeferredDestroy
+    {
+        uint32_t frameNumber;
+        std::function<void()> destroy;
+    };
+
+    void DeferDestroy(uint32_t frameNumber, std::function<void()> destroy)
+    {
+        DeferredDestroy entry = { frameNumber, std::move(destroy) };
+        deferredDestroys.push_back(std::move(entry));
+    }
+
+    // completedFrames is the number of frames known to be finished, fence signals cover every earlier submission on the queue
+    void FlushDeferredDestroys(uint32_t completedFrames)
+    {
+        while (!deferredDestroys.empty() && deferredDestroys.front().frameNumber <= completedFrames)
+        {
+            deferredDestroys.front().destroy();
+            deferredDestroys.pop_front();
+        }
+    }
+
+    // recreates the swapchain and the depth buffer at the new size without waiting for the gpu, frames still in flight keep
+    // rendering into the old ones until they are retired
+    void ResizeSwapchain(Swapchain& swapchain, const VkPhysicalDeviceMemoryProperties& memProps, uint32_t width, uint32_t height, uint32_t frameNumber)
+    {
+        Swapchain oldSwapchain = swapchain;
+        Image oldDepthImage = depthImage;
+        VkImageView oldDepthImageView = depthImageView;
+        DepthPyramid oldDepthPyramid = depthPyramid;
+
+        CreateDepthTarget(memProps, width, height);
+
+        if (!CreateSwapchain(swapchain, width, height, oldSwapchain.swapchain))
+            throw std::runtime_error("Cannot make a swapchain");
+
+        DeferDestroy(frameNumber, [this, oldSwapchain, oldDepthImage, oldDepthImageView, oldDepthPyramid]() mutable
+        {
+            DestroySwapchain(oldSwapchain);
+            vkDestroyImageView(device, oldDepthImageView, 0);
+            DestroyImage(oldDepthImage);
+            DestroyDepthPyramid(oldDepthPyramid);
+        });
+    }
+
+    void DestroySwapchain(Swapchain& swapchain)
+    {
+        for (uint32_t i = 0; i < swapchain.imageCount; ++i)
+        {
+            vkDestroyImageView(device, swapchain.imageViews[i], 0);
+            vkDestroySemaphore(device, swapchain.releaseSemaphores[i], 0);
+        }
+
+        vkDestroySwapchainKHR(device, swapchain.swapchain, 0);
+    }
+
+    // stands in for the swapchain in headless mode, the color image is never presented
+    struct OffscreenTarget
+    {
+        Image color;
+        VkImageView colorView;
+
+        uint32_t width, height;
+    };
+
+    void CreateOffscreenTarget(OffscreenTarget& result, const VkPhysicalDeviceMemoryProperties& memProps, uint32_t width, uint32_t height)
+    {
+        // transfer src so the rendered frame can be read back for inspection
+        CreateImage(result.color, memProps, swapchainFormat, width, height, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+        result.colorView = CreateImageView(result.color.image, swapchainFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+        result.width = width;
+        result.height = height;
+    }
+
+    void DestroyOffscreenTarget(OffscreenTarget& target)
+    {
+        vkDestroyImageView(device, target.colorView, 0);
+        DestroyImage(target.color);
+    }
+
+    static const uint32_t kMaxPyramidLevels = 16;
+
+    // workgroup size of depth_pyramid.comp.glsl in both dimensions
+    static const uint32_t kPyramidGroupSize = 8;
+
+    // max reduction of the depth buffer for occlusion culling, level 0 is half the depth resolution and every texel holds the
+    // farthest depth of the texels it covers
+    struct DepthPyramid
+    {
+        Image image;
+        VkImageView view; // all levels, sampled by the occlusion culling pass
+        VkImageView levels[kMaxPyramidLevels];
+
+        uint32_t width, height;
+        uint32_t levelCount;
+
+        // the image starts out undefined and the next frame moves it to GENERAL, which the culling descriptors declare
+        bool needsTransition;
+    };
+
+    void CreateDepthPyramid(DepthPyramid& result, const VkPhysicalDeviceMemoryProperties& memProps, uint32_t depthWidth, uint32_t depthHeight)
+    {
+        result.width = std::max(depthWidth / 2, 1u);
+        result.height = std::max(depthHeight / 2, 1u);
+        result.levelCount = MipLevelCount(result.width, result.height);
+
+        if (result.levelCount > kMaxPyramidLevels)
+            throw std::runtime_error("Depth pyramid has too many levels");
+
+        CreateImage(result.image, memProps, VK_FORMAT_R32_SFLOAT, result.width, result.height, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, result.levelCount);
+        result.view = CreateImageView(result.image.image, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, result.levelCount);
+
+        for (uint32_t i = 0; i < result.levelCount; ++i)
+            result.levels[i] = CreateImageView(result.image.image, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, 1, i);
+
+        result.needsTransition = true;
+    }
+
+    void DestroyDepthPyramid(DepthPyramid& pyramid)
+    {
+        if (!pyramid.image.image)
+            return;
+
+        for (uint32_t i = 0; i < pyramid.levelCount; ++i)
+            vkDestroyImageView(device, pyramid.levels[i], 0);
+
+        vkDestroyImageView(device, pyramid.view, 0);
+        DestroyImage(pyramid.image);
+    }
+
+    // the depth buffer and, with --occlusion, the pyramid built from it, both sized like the render target
+    void CreateDepthTarget(const VkPhysicalDeviceMemoryProperties& memProps, uint32_t width, uint32_t height)
+    {
+        VkImageUsageFlags depthUsage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | (options.occlusion ? VK_IMAGE_USAGE_SAMPLED_BIT : 0);
+
+        CreateImage(depthImage, memProps, VK_FORMAT_D32_SFLOAT, width, height, depthUsage);
+        depthImageView = CreateImageView(depthImage.image, VK_FORMAT_D32_SFLOAT, VK_IMAGE_ASPECT_DEPTH_BIT);
+
+        if (options.occlusion)
+            CreateDepthPyramid(depthPyramid, memProps, width, height);
+    }
+
+    struct FrameTimings
+    {
+        std::vector<double> cpu;
+        std::vector<double> gpu;
+        std::vector<double> wait;
+        std::vector<double> frame;
+    };
+
+    void PrintTimingSummary(const char* name, const std::vector<double>& times)
+    {
+        if (times.empty())
+            return;
+
+        double total = 0.0;
+        double minTime = times[0];
+        double maxTime = times[0];
+
+        for (double t : times)
+        {
+            total += t;
+            minTime = std::min(minTime, t);
+            maxTime = std::max(maxTime, t);
+        }
+
+        printf("%s: avg %.3f ms, min %.3f ms, max %.3f ms\n", name, total / times.size(), minTime, maxTime);
+    }
+
+    void PrintFrameTimings(const FrameTimings& timings)
+    {
+        std::cout << "Rendered " << timings.frame.size() << " frames with " << frames.size() << " frames in flight" << std::endl;
+
+        PrintTimingSummary("cpu", timings.cpu);
+        PrintTimingSummary("gpu", timings.gpu);
+        PrintTimingSummary("wait", timings.wait);
+        PrintTimingSummary("frame", timings.frame);
+
+        double total = 0.0;
+        for (double t : timings.frame)
+            total += t;
+
+        if (total > 0.0)
+            printf("throughput: %.1f fps\n", timings.frame.size() * 1000.0 / total);
+    }
+
+    // the fps over the slowest fraction of the frames, so rare hitches show up even when the average is high
+    double LowFps(const std::vector<double>& sortedTimes, double fraction)
+    {
+        size_t count = std::max(size_t(1), size_t(sortedTimes.size() * fraction));
+
+        double total = 0.0;
+        for (size_t i = sortedTimes.size() - count; i < sortedTimes.size(); ++i)
+            total += sortedTimes[i];
+
+        return total > 0.0 ? count * 1000.0 / total : 0.0;
+    }
+
+    void PrintBenchmark(const FrameTimings& timings)
+    {
+        if (timings.frame.empty())
+        {
+            std::cout << "Benchmark ended before loading finished" << std::endl;
+            return;
+        }
+
+        std::vector<double> times = timings.frame;
+
+        double total = 0.0;
+        for (double t : times)
+            total += t;
+
+        std::sort(times.begin(), times.end());
+
+        printf("benchmark: %zu frames in %.2f s (%s), avg %.1f fps, 1%% low %.1f fps, 0.1%% low %.1f fps\n", times.size(), total / 1000.0,
+            options.headless ? "headless" : presentModeName(presentMode), times.size() * 1000.0 / total, LowFps(times, 0.01), LowFps(times, 0.001));
+    }
+
+    void DebugExtensionSupport()
+    {
+        // Details of extensions supported
+        uint32_t extensionCount = 0;
+
+        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+        std::vector<VkExtensionProperties> extensions(extensionCount);
+        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+
+        std::cout << "available extensions:\n";
+
+        for (const auto& extension : extensions) {
+            std::cout << '\t' << extension.extensionName << '\n';
+        }
+    }
+
+    VkSemaphore CreateVulkanSemaphore()
+    {
+        VkSemaphoreCreateInfo createInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+
+        VkSemaphore semaphore = 0;
+        VK_CHECK(vkCreateSemaphore(device, &createInfo, 0, &semaphore));
+
+        return semaphore;
+    }
+
+    VkFence CreateFence(VkFenceCreateFlags flags)
+    {
+        VkFenceCreateInfo createInfo = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+        createInfo.flags = flags;
+
+        VkFence fence = 0;
+        VK_CHECK(vkCreateFence(device, &createInfo, 0, &fence));
+
+        return fence;
+    }
+
+    VkCommandPool CreateCommandPool(VkCommandPoolCreateFlags flags, uint32_t familyIndex)
+    {
+        VkCommandPoolCreateInfo createInfo = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+        createInfo.flags = flags;
+        createInfo.queueFamilyIndex = familyIndex;
+
+        VkCommandPool pool = 0;
+        VK_CHECK(vkCreateCommandPool(device, &createInfo, 0, &pool));
+
+        return pool;
+    }
+
+    VkCommandBuffer AllocateCommandBuffer(VkCommandPool pool, VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY)
+    {
+        VkCommandBufferAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+        allocateInfo.commandPool = pool;
+        allocateInfo.level = level;
+        allocateInfo.commandBufferCount = 1;
+
+        VkCommandBuffer commandBuffer = 0;
+        VK_CHECK(vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer));
+
+        return commandBuffer;
+    }
+
+    // timestamp pairs per frame, scope 0 is the whole frame
+    static const uint32_t kMaxGpuScopes = 16;
+
+    // results are written in bit order, GpuStatisticName must match
+    static const VkQueryPipelineStatisticFlags kGpuStatistics =
+        VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT | VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+    static const uint32_t kGpuStatisticCount = countBits(kGpuStatistics);
+
+    // frames between the rolling gpu profile logs of --gpu-profile
+    static const uint32_t kGpuProfileLogInterval = 100;
+
+    // frames kept for the summary and gpu_profile.json at exit, about 20 minutes at 60 fps, later frames are only in the rolling logs
+    static const uint32_t kMaxGpuProfiles = 65536;
+
+    // everything a frame needs to be recorded while the previous frames are still executing on the gpu
+    struct FrameData
+    {
+        VkCommandPool commandPool;
+        VkCommandBuffer commandBuffer;
+        VkFence fence;
+        VkSemaphore acquireSemaphore;
+        VkQueryPool timestampQueryPool;
+        VkQueryPool statisticsQueryPool;
+
+        // names of the gpu scopes written by the last submission, string literals
+        const char* scopeNames[kMaxGpuScopes];
+        uint32_t scopeCount;
+        bool statisticsActive;
+
+        // a pool and secondary command buffer per recording thread, pools are only used by one thread at a time
+        std::vector<VkCommandPool> recordCommandPools;
+        std::vector<VkCommandBuffer> recordCommandBuffers;
+
+        // set while the last submission using this slot has timestamps that haven't been read yet
+        bool pending;
+        // frame number of the last submission using this slot
+        uint32_t frameNumber;
+    };
+
+    void CreateFrames()
+    {
+        frames.resize(options.framesInFlight);
+
+        for (FrameData& frame : frames)
+        {
+            frame.commandPool = CreateCommandPool(VK_COMMAND_POOL_CREATE_TRANSIENT_BIT, queueFamilyIndex);
+            frame.commandBuffer = AllocateCommandBuffer(frame.commandPool);
+
+            // created signaled so the first wait on every slot returns immediately
+            frame.fence = CreateFence(VK_FENCE_CREATE_SIGNALED_BIT);
+            frame.acquireSemaphore = CreateVulkanSemaphore();
+            frame.timestampQueryPool = CreateQueryPool(VK_QUERY_TYPE_TIMESTAMP, 2 * kMaxGpuScopes);
+            frame.statisticsQueryPool = options.gpuProfile && pipelineStatisticsSupported ? CreateQueryPool(VK_QUERY_TYPE_PIPELINE_STATISTICS, 1, kGpuStatistics) : VK_NULL_HANDLE;
+            frame.scopeCount = 0;
+            frame.statisticsActive = false;
+
+            if (options.recordThreads > 1)
+            {
+                for (uint32_t i = 0; i < options.recordThreads; ++i)
+                {
+                    frame.recordCommandPools.push_back(CreateCommandPool(VK_COMMAND_POOL_CREATE_TRANSIENT_BIT, queueFamilyIndex));
+                    frame.recordCommandBuffers.push_back(AllocateCommandBuffer(frame.recordCommandPools.back(), VK_COMMAND_BUFFER_LEVEL_SECONDARY));
+                }
+            }
+
+            frame.pending = false;
+            frame.frameNumber = 0;
+        }
+    }
+
+    void DestroyFrames()
+    {
+        for (FrameData& frame : frames)
+        {
+            vkDestroyQueryPool(device, frame.timestampQueryPool, 0);
+            vkDestroyQueryPool(device, frame.statisticsQueryPool, 0);
+            vkDestroySemaphore(device, frame.acquireSemaphore, 0);
+            vkDestroyFence(device, frame.fence, 0);
+            vkDestroyCommandPool(device, frame.commandPool, 0);
+
+            for (VkCommandPool pool : frame.recordCommandPools)
+                vkDestroyCommandPool(device, pool, 0);
+        }
+
+        frames.clear();
+    }
+
+    struct GpuScopeTime
+    {
+        const char* name;
+        double time;
+    };
+
+    struct GpuFrameProfile
+    {
+        uint32_t frameNumber;
+        std::vector<GpuScopeTime> scopes;
+        bool hasStatistics;
+        uint64_t statistics[kGpuStatisticCount];
+    };
+
+    const char* GpuStatisticName(uint32_t index)
+    {
+        static const char* const names[] = { "input assembly primitives", "vertex invocations", "clipping primitives", "fragment invocations", "compute invocations" };
+        static_assert(sizeof(names) / sizeof(names[0]) == kGpuStatisticCount, "every statistic in kGpuStatistics needs a name");
+
+        return names[index];
+    }
+
+    // scopes may nest, they are timed from the top to the bottom of the pipe so overlapping work is counted in every scope it overlaps
+    uint32_t BeginGpuScope(FrameData& frame, VkCommandBuffer commandBuffer, const char* name)
+    {
+        if (frame.scopeCount == kMaxGpuScopes)
+            throw std::runtime_error("Too many gpu scopes in one frame");
+
+        uint32_t scope = frame.scopeCount++;
+        frame.scopeNames[scope] = name;
+
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.timestampQueryPool, 2 * scope);
+
+        return scope;
+    }
+
+    void EndGpuScope(FrameData& frame, VkCommandBuffer commandBuffer, uint32_t scope)
+    {
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame.timestampQueryPool, 2 * scope + 1);
+    }
+
+    // must only be called once the frame's fence has signaled, so the results are read framesInFlight frames later without waiting
+    GpuFrameProfile ReadGpuProfile(FrameData& frame)
+    {
+        uint64_t timestamps[2 * kMaxGpuScopes] = {};
+        VK_CHECK(vkGetQueryPoolResults(device, frame.timestampQueryPool, 0, 2 * frame.scopeCount, sizeof(timestamps), timestamps, sizeof(timestamps[0]), VK_QUERY_RESULT_64_BIT));
+
+        GpuFrameProfile profile = {};
+        profile.frameNumber = frame.frameNumber;
+
+        for (uint32_t i = 0; i < frame.scopeCount; ++i)
+        {
+            // only the low timestampValidBits are defined, masking the difference also handles a counter that wrapped within the scope
+            uint64_t ticks = ((timestamps[2 * i + 1] & timestampMask) - (timestamps[2 * i] & timestampMask)) & timestampMask;
+
+            profile.scopes.push_back({ frame.scopeNames[i], double(ticks) * timestampPeriod * 1e-6 });
+        }
+
+        if (frame.statisticsActive)
+        {
+            VK_CHECK(vkGetQueryPoolResults(device, frame.statisticsQueryPool, 0, 1, sizeof(profile.statistics), profile.statistics, sizeof(profile.statistics), VK_QUERY_RESULT_64_BIT));
+            profile.hasStatistics = true;
+        }
+
+        frame.pending = false;
+
+        return profile;
+    }
+
+    // average, min and max of every scope and the average statistics over [begin, end)
+    void PrintGpuProfile(const std::vector<GpuFrameProfile>& profiles, size_t begin, size_t end)
+    {
+        std::vector<const char*> names;
+
+        for (size_t i = begin; i < end; ++i)
+            for (const GpuScopeTime& scope : profiles[i].scopes)
+                if (std::find_if(names.begin(), names.end(), [&](const char* name) { return strcmp(name, scope.name) == 0; }) == names.end())
+                    names.push_back(scope.name);
+
+        printf("gpu frames %u-%u:\n", profiles[begin].frameNumber, profiles[end - 1].frameNumber);
+
+        for (const char* name : names)
+        {
+            std::vector<double> times;
+
+            for (size_t i = begin; i < end; ++i)
+                for (const GpuScopeTime& scope : profiles[i].scopes)
+                    if (strcmp(scope.name, name) == 0)
+                        times.push_back(scope.time);
+
+            printf("    ");
+            PrintTimingSummary(name, times);
+        }
+
+        uint64_t totals[kGpuStatisticCount] = {};
+        size_t count = 0;
+
+        for (size_t i = begin; i < end; ++i)
+        {
+            if (!profiles[i].hasStatistics)
+                continue;
+
+            for (uint32_t j = 0; j < kGpuStatisticCount; ++j)
+                totals[j] += profiles[i].statistics[j];
+
+            count++;
+        }
+
+        for (uint32_t j = 0; j < kGpuStatisticCount && count > 0; ++j)
+            printf("    %s: %.0f per frame\n", GpuStatisticName(j), double(totals[j]) / count);
+    }
+
+    // one object per frame with the scope times in milliseconds and the statistics, for offline analysis
+    void WriteGpuProfile(const std::vector<GpuFrameProfile>& profiles, const char* path)
+    {
+        FILE* file = fopen(path, "w");
+        if (!file)
+        {
+            std::cout << "Can't write gpu profile " << path << std::endl;
+            return;
+        }
+
+        fprintf(file, "{\n  \"timestampPeriod\": %f,\n  \"frames\": [\n", timestampPeriod);
+
+        for (size_t i = 0; i < profiles.size(); ++i)
+        {
+            const GpuFrameProfile& profile = profiles[i];
+
+            fprintf(file, "    { \"frame\": %u, \"scopes\": {", profile.frameNumber);
+
+            for (size_t j = 0; j < profile.scopes.size(); ++j)
+                fprintf(file, "%s \"%s\": %.6f", j ? "," : "", profile.scopes[j].name, profile.scopes[j].time);
+
+            fprintf(file, " }");
+
+            if (profile.hasStatistics)
+            {
+                fprintf(file, ", \"statistics\": {");
+
+                for (uint32_t j = 0; j < kGpuStatisticCount; ++j)
+                    fprintf(file, "%s \"%s\": %llu", j ? "," : "", GpuStatisticName(j), (unsigned long long)profile.statistics[j]);
+
+                fprintf(file, " }");
+            }
+
+            fprintf(file, " }%s\n", i + 1 < profiles.size() ? "," : "");
+        }
+
+        fprintf(file, "  ]\n}\n");
+        fclose(file);
+
+        printf("Wrote %zu gpu frame profiles to %s\n", profiles.size(), path);
+    }
+
+    VkImageView CreateImageView(VkImage swapchainImage, VkFormat swapchainFormat, VkImageAspectFlags aspectFlags, uint32_t mipLevels = 1, uint32_t baseMipLevel = 0)
+    {
+        VkImageViewCreateInfo createInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+        createInfo.image = swapchainImage;
+        createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        createInfo.format = swapchainFormat;
+        createInfo.subresourceRange.aspectMask = aspectFlags;
+        createInfo.subresourceRange.baseMipLevel = baseMipLevel;
+        createInfo.subresourceRange.levelCount = mipLevels;
+        createInfo.subresourceRange.layerCount = 1;
+
+        VkImageView imageView = 0;
+        VK_CHECK(vkCreateImageView(device, &createInfo, 0, &imageView));
+
+        return imageView;
+    }
+
+    VkShaderModule CreateShader(const char* path)
+    {
+        // Read file contents from path
+        FILE* file = fopen(path, "rb");
+
+        fseek(file, 0, SEEK_END);
+        long length = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        char* buffer = new char[length];
+        size_t rc = fread(buffer, 1, length, file);
+        fclose(file);
+
+        // Fill Create info struct
+        VkShaderModuleCreateInfo createInfo = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+        createInfo.codeSize = length;
+        createInfo.pCode = reinterpret_cast<const uint32_t*>(buffer);
+
+        // Create Shader module
+        VkShaderModule shaderModule = 0;
+        VK_CHECK(vkCreateShaderModule(device, &createInfo, 0, &shaderModule));
+
+        return shaderModule;
+    }
+
+    // the cache file lives in the working directory next to shaders/
+    static constexpr const char* kPipelineCachePath = "pipeline.cache";
+
+    // drivers reject data from other devices or driver versions on their own, checking the header first lets the log say why
+    bool IsPipelineCacheCompatible(const void* data, size_t size)
+    {
+        VkPipelineCacheHeaderVersionOne header;
+        if (size < sizeof(header))
+            return false;
+
+        memcpy(&header, data, sizeof(header));
+
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(physicalDevice, &props);
+
+        return header.headerSize >= sizeof(header) && header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+            header.vendorID == props.vendorID && header.deviceID == props.deviceID && memcmp(header.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+    }
+
+    // starts from the data saved by the previous run when there is a compatible file at path, otherwise from an empty cache
+    VkPipelineCache CreatePipelineCache(const char* path = nullptr)
+    {
+        VkPipelineCacheCreateInfo createInfo = { VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+        createInfo.initialDataSize = 0;
+        createInfo.pInitialData = nullptr;
+
+        MappedFile file;
+        if (path && mapFile(file, path))
+        {
+            if (IsPipelineCacheCompatible(file.data, file.size))
+            {
+                createInfo.initialDataSize = file.size;
+                createInfo.pInitialData = file.data;
+            }
+            else
+                std::cout << "Ignoring pipeline cache " << path << " from another device or driver" << std::endl;
+        }
+
+        VkPipelineCache pipelineCache = 0;
+        VK_CHECK(vkCreatePipelineCache(device, &createInfo, 0, &pipelineCache));
+
+        pipelineCacheWarm = createInfo.initialDataSize != 0;
+        pipelineCacheSaved.assign(static_cast<const char*>(createInfo.pInitialData), static_cast<const char*>(createInfo.pInitialData) + createInfo.initialDataSize);
+
+        unmapFile(file);
+
+        return pipelineCache;
+    }
+
+    // called once the background compiles are done and at exit, nothing is written unless the data changed since the last save
+    void SavePipelineCache(VkPipelineCache cache, const char* path)
+    {
+        size_t size = 0;
+        VK_CHECK(vkGetPipelineCacheData(device, cache, &size, 0));
+
+        std::vector<char> data(size);
+        VK_CHECK(vkGetPipelineCacheData(device, cache, &size, data.data()));
+        data.resize(size);
+
+        if (data == pipelineCacheSaved)
+            return;
+
+        // write to a temporary file first so a crash never leaves a truncated cache behind
+        std::string tempPath = std::string(path) + ".tmp";
+
+        FILE* file = fopen(tempPath.c_str(), "wb");
+        if (!file)
+        {
+            std::cout << "Can't write pipeline cache " << path << std::endl;
+            return;
+        }
+
+        bool written = fwrite(data.data(), 1, size, file) == size;
+        written = closeFileSynced(file) && written;
+
+        if (!written || !replaceFile(tempPath.c_str(), path))
+        {
+            remove(tempPath.c_str());
+            std::cout << "Can't write pipeline cache " << path << std::endl;
+            return;
+        }
+
+        pipelineCacheSaved.swap(data);
+    }
+
+    VkQueryPool CreateQueryPool(VkQueryType type, uint32_t queryCount, VkQueryPipelineStatisticFlags pipelineStatistics = 0)
+    {
+        VkQueryPoolCreateInfo createInfo = { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+        createInfo.queryType = type;
+        createInfo.queryCount = queryCount;
+        createInfo.pipelineStatistics = pipelineStatistics;
+
+        VkQueryPool queryPool = 0;
+        VK_CHECK(vkCreateQueryPool(device, &createInfo, 0, &queryPool));
+
+        return queryPool;
+    }
+
+    VkDescriptorSetLayoutBinding DescriptorBinding(uint32_t binding, VkDescriptorType type, VkShaderStageFlags stageFlags, uint32_t descriptorCount = 1)
+    {
+        VkDescriptorSetLayoutBinding result = {};
+        result.binding = binding;
+        result.descriptorCount = descriptorCount;
+        result.descriptorType = type;
+        result.stageFlags = stageFlags;
+
+        return result;
+    }
+
+    // all sets use push descriptors, the push constants are always a MeshPushConstants block
+    VkPipelineLayout CreatePipelineLayout(VkDescriptorSetLayout& setLayout, const std::vector<VkDescriptorSetLayoutBinding>& setBindings, VkShaderStageFlags pushConstantStages)
+    {
+        VkDescriptorSetLayoutCreateInfo descriptorCreateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+        descriptorCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR;
+        descriptorCreateInfo.bindingCount = static_cast<uint32_t>(setBindings.size());
+        descriptorCreateInfo.pBindings = setBindings.data();
+
+        VK_CHECK(vkCreateDescriptorSetLayout(device, &descriptorCreateInfo, 0, &setLayout));
+
+        VkPushConstantRange pushConstantRange = {};
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(MeshPushConstants);
+        pushConstantRange.stageFlags = pushConstantStages;
+
+        VkPipelineLayoutCreateInfo createInfo = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+        createInfo.setLayoutCount = 1;
+        createInfo.pSetLayouts = &setLayout;
+        createInfo.pushConstantRangeCount = 1;
+        createInfo.pPushConstantRanges = &pushConstantRange;
+
+        VkPipelineLayout pipelineLayout = 0;
+        VK_CHECK(vkCreatePipelineLayout(device, &createInfo, 0, &pipelineLayout));
+
+        return pipelineLayout;
+    }
+
+    VkPipelineShaderStageCreateInfo ShaderStage(VkShaderStageFlagBits stage, VkShaderModule module)
+    {
+        VkPipelineShaderStageCreateInfo result = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
+        result.stage = stage;
+        result.module = module;
+        result.pName = "main";
+
+        return result;
+    }
+
+    static const uint32_t kMaxPipelineStages = 3;
+
+    // everything a pipeline is built from, hashed as raw bytes to key the pipeline registry so it has no padding and no pointers
+    struct PipelineState
+    {
+        VkShaderModule modules[kMaxPipelineStages];
+        VkPipelineLayout layout;
+
+        VkPipelineBindPoint bindPoint;
+        uint32_t stageCount;
+        VkShaderStageFlagBits stages[kMaxPipelineStages];
+        VkFormat colorFormat;
+        VkFormat depthFormat;
+        VkPrimitiveTopology topology;
+        VkPolygonMode polygonMode;
+        VkCullModeFlags cullMode;
+        VkBool32 depthTest;
+        VkBool32 depthWrite;
+        VkCompareOp depthCompareOp;
+        VkBool32 blendEnable;
+    };
+
+    static_assert(sizeof(PipelineState) == 8 * (kMaxPipelineStages + 1) + 4 * (kMaxPipelineStages + 11), "PipelineState must not contain padding");
+
+    // opaque depth tested triangles into the swapchain format color and depth attachments, the state every mesh pipeline starts from
+    PipelineState GraphicsPipelineState(VkPipelineLayout layout, const std::vector<VkPipelineShaderStageCreateInfo>& stages)
+    {
+        PipelineState state;
+        memset(&state, 0, sizeof(state));
+
+        if (stages.size() > kMaxPipelineStages)
+            throw std::runtime_error("Too many pipeline stages");
+
+        state.layout = layout;
+        state.bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        state.stageCount = uint32_t(stages.size());
+
+        for (size_t i = 0; i < stages.size(); ++i)
+        {
+            state.stages[i] = stages[i].stage;
+            state.modules[i] = stages[i].module;
+        }
+
+        state.colorFormat = swapchainFormat;
+        state.depthFormat = VK_FORMAT_D32_SFLOAT;
+        state.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        state.polygonMode = VK_POLYGON_MODE_FILL;
+        state.cullMode = VK_CULL_MODE_BACK_BIT;
+        state.depthTest = VK_TRUE;
+        state.depthWrite = VK_TRUE;
+        state.depthCompareOp = VK_COMPARE_OP_LESS;
+        state.blendEnable = VK_FALSE;
+
+        return state;
+    }
+
+    PipelineState ComputePipelineState(VkPipelineLayout layout, VkShaderModule cs)
+    {
+        PipelineState state;
+        memset(&state, 0, sizeof(state));
+
+        state.layout = layout;
+        state.bindPoint = VK_PIPELINE_BIND_POINT_COMPUTE;
+        state.stageCount = 1;
+        state.stages[0] = VK_SHADER_STAGE_COMPUTE_BIT;
+        state.modules[0] = cs;
+
+        return state;
+    }
+
+    // only reads the state and the internally synchronized cache, so pipelines can be created on several threads at once
+    VkPipeline CreateGraphicsPipeline(VkPipelineCache cache, const PipelineState& state)
+    {
+        VkGraphicsPipelineCreateInfo createInfo = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+
+        VkPipelineShaderStageCreateInfo stages[kMaxPipelineStages];
+        for (uint32_t i = 0; i < state.stageCount; ++i)
+            stages[i] = ShaderStage(state.stages[i], state.modules[i]);
+
+        createInfo.stageCount = state.stageCount;
+        createInfo.pStages = stages;
+
+        bool meshPipeline = false;
+        for (uint32_t i = 0; i < state.stageCount; ++i)
+            meshPipeline |= state.stages[i] == VK_SHADER_STAGE_MESH_BIT_EXT;
+
+        // everything is left to 0 because our vertex data is in the shader itself
+        VkPipelineVertexInputStateCreateInfo vertexInput = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
+
+        VkPipelineInputAssemblyStateCreateInfo inputAssembly = { VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
+        inputAssembly.topology = state.topology;
+
+        // mesh shaders emit primitives themselves so there is no vertex input or input assembly stage
+        if (!meshPipeline)
+        {
+            createInfo.pVertexInputState = &vertexInput;
+            createInfo.pInputAssemblyState = &inputAssembly;
+        }
+
+        // viewport should be set dynamically
+        VkPipelineViewportStateCreateInfo viewportState = { VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
+        viewportState.viewportCount = 1;
+        viewportState.scissorCount = 1;
+        createInfo.pViewportState = &viewportState;
+
+        VkPipelineRasterizationStateCreateInfo rasterizationState = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
+        rasterizationState.polygonMode = state.polygonMode;
+        rasterizationState.cullMode = state.cullMode;
+        rasterizationState.lineWidth = 1.0;
+        createInfo.pRasterizationState = &rasterizationState;
+
+        VkPipelineMultisampleStateCreateInfo multisampleState = { VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
+        multisampleState.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+        createInfo.pMultisampleState = &multisampleState;
+
+        VkPipelineDepthStencilStateCreateInfo depthStencilState = { VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
+        depthStencilState.depthTestEnable = state.depthTest;
+        depthStencilState.depthWriteEnable = state.depthWrite;
+        depthStencilState.depthCompareOp = state.depthCompareOp;
+        createInfo.pDepthStencilState = &depthStencilState;
+
+        // premultiplied alpha when blending is on
+        VkPipelineColorBlendAttachmentState colorAttachmentState = {};
+        colorAttachmentState.blendEnable = state.blendEnable;
+        colorAttachmentState.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        colorAttachmentState.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        colorAttachmentState.colorBlendOp = VK_BLEND_OP_ADD;
+        colorAttachmentState.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        colorAttachmentState.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        colorAttachmentState.alphaBlendOp = VK_BLEND_OP_ADD;
+        colorAttachmentState.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+        VkPipelineColorBlendStateCreateInfo colorBlendState = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
+        colorBlendState.attachmentCount = 1;
+        colorBlendState.pAttachments = &colorAttachmentState;
+        createInfo.pColorBlendState = &colorBlendState;
+
+        VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+        VkPipelineDynamicStateCreateInfo dynamicState = { VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
+        dynamicState.dynamicStateCount = sizeof(dynamicStates) / sizeof(dynamicStates[0]);
+        dynamicState.pDynamicStates = dynamicStates;
+        createInfo.pDynamicState = &dynamicState;
+
+        createInfo.layout = state.layout;
+
+        // dynamic rendering only needs the attachment formats, pipelines don't depend on a render pass object
+        VkPipelineRenderingCreateInfo renderingInfo = { VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO };
+        renderingInfo.colorAttachmentCount = 1;
+        renderingInfo.pColorAttachmentFormats = &state.colorFormat;
+        renderingInfo.depthAttachmentFormat = state.depthFormat;
+        createInfo.pNext = &renderingInfo;
+
+        VkPipeline pipeline = 0;
+        VK_CHECK(vkCreateGraphicsPipelines(device, cache, 1, &createInfo, 0, &pipeline));
+
+        return pipeline;
+    }
+
+    VkPipeline CreateComputePipeline(VkPipelineCache cache, const PipelineState& state)
+    {
+        VkComputePipelineCreateInfo createInfo = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+        createInfo.stage = ShaderStage(VK_SHADER_STAGE_COMPUTE_BIT, state.modules[0]);
+        createInfo.layout = state.layout;
+
+        VkPipeline pipeline = 0;
+        VK_CHECK(vkCreateComputePipelines(device, cache, 1, &createInfo, 0, &pipeline));
+
+        return pipeline;
+    }
+
+    VkPipeline CreatePipeline(VkPipelineCache cache, const PipelineState& state)
+    {
+        TRACE_ZONE("CreatePipeline");
+
+        return state.bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE ? CreateComputePipeline(cache, state) : CreateGraphicsPipeline(cache, state);
+    }
+
+
+
+    VkDescriptorBufferInfo BufferInfo(const Buffer& buffer)
+    {
+        VkDescriptorBufferInfo result = {};
+        result.buffer = buffer.buffer;
+        result.offset = 0;
+        result.range = buffer.size;
+
+        return result;
+    }
+
+    VkWriteDescriptorSet ImageDescriptor(uint32_t binding, VkDescriptorType type, const VkDescriptorImageInfo* imageInfo)
+    {
+        VkWriteDescriptorSet result = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+        result.dstBinding = binding;
+        result.descriptorCount = 1;
+        result.descriptorType = type;
+        result.pImageInfo = imageInfo;
+
+        return result;
+    }
+
+    VkWriteDescriptorSet BufferDescriptor(uint32_t binding, const VkDescriptorBufferInfo* bufferInfo)
+    {
+        VkWriteDescriptorSet result = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+        result.dstBinding = binding;
+        result.descriptorCount = 1;
+        result.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        result.pBufferInfo = bufferInfo;
+
+        return result;
+    }
+
+    VkImageMemoryBarrier ImageBarrier(VkImage image,
+        VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask, VkImageLayout oldLayout, VkImageLayout newLayout, VkImageAspectFlags aspectMask = VK_IMAGE_ASPECT_COLOR_BIT)
+    {
+        VkImageMemoryBarrier result = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+
+        result.srcAccessMask = srcAccessMask;
+        result.dstAccessMask = dstAccessMask;
+        result.oldLayout = oldLayout;
+        result.newLayout = newLayout;
+        result.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        result.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        result.image = image;
+        result.subresourceRange.aspectMask = aspectMask;
+        result.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+        result.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+
+        return result;
+    }
+
+    VkImageMemoryBarrier2 ImageBarrier2(VkImage image, VkPipelineStageFlags2 srcStageMask, VkAccessFlags2 srcAccessMask, VkImageLayout oldLayout,
+        VkPipelineStageFlags2 dstStageMask, VkAccessFlags2 dstAccessMask, VkImageLayout newLayout, VkImageAspectFlags aspectMask = VK_IMAGE_ASPECT_COLOR_BIT)
+    {
+        VkImageMemoryBarrier2 result = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+
+        result.srcStageMask = srcStageMask;
+        result.srcAccessMask = srcAccessMask;
+        result.dstStageMask = dstStageMask;
+        result.dstAccessMask = dstAccessMask;
+        result.oldLayout = oldLayout;
+        result.newLayout = newLayout;
+        result.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        result.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        result.image = image;
+        result.subresourceRange.aspectMask = aspectMask;
+        result.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+        result.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+
+        return result;
+    }
+
+    void PipelineBarrier(VkCommandBuffer commandBuffer, VkDependencyFlags dependencyFlags, uint32_t imageBarrierCount, const VkImageMemoryBarrier2* imageBarriers)
+    {
+        VkDependencyInfo dependencyInfo = { VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+        dependencyInfo.dependencyFlags = dependencyFlags;
+        dependencyInfo.imageMemoryBarrierCount = imageBarrierCount;
+        dependencyInfo.pImageMemoryBarriers = imageBarriers;
+
+        vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+    }
+
+    struct Vertex
+    {
+        float vx, vy, vz;
+        uint8_t nx, ny, nz, nw;
+        float tu, tv;
+    };
+
+    // compact layout used with --quantize-meshes, must match mesh_quantized.vert.glsl
+    struct QuantizedVertex
+    {
+        uint16_t vx, vy, vz; // unorm16 inside the mesh bounds, see Mesh::positionTransform
+        int8_t nu, nv;       // octahedral encoded normal
+        uint16_t tu, tv;     // half floats
+    };
+
+    // gpu layout of a meshlet, must match Meshlet in culling.glsl
+    struct Meshlet
+    {
+        float center[3];
+        float radius;
+        int8_t coneAxis[3];      // normal cone, quantized by meshoptimizer so culling with it stays conservative
+        int8_t coneCutoff;
+        uint32_t vertexOffset;   // first entry in meshletVertices
+        uint32_t triangleOffset; // first byte in meshletTriangles
+        uint8_t vertexCount;
+        uint8_t triangleCount;
+        uint16_t padding;
+    };
+
+    static_assert(sizeof(Meshlet) == 32, "Meshlet must match the std430 layout in culling.glsl");
+
+    // workgroup sizes of the culling compute shaders and meshlet.task.glsl, one invocation per meshlet or object
+    static const uint32_t kCullGroupSize = 64;
+    static const uint32_t kTaskGroupSize = 32;
+
+    // limits of one meshlet, 124 triangles keeps the local index buffer a multiple of 4 bytes
+    static const size_t kMeshletMaxVertices = 64;
+    static const size_t kMeshletMaxTriangles = 124;
+
+    // a level of detail is a range of the mesh index buffer, must match MeshLod in culling.glsl
+    struct MeshLod
+    {
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        float error; // mesh space distance to the full detail surface
+    };
+
+    static const size_t kMaxLods = 8;
+
+    struct Mesh
+    {
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+
+        std::vector<QuantizedVertex> quantizedVertices;
+        std::vector<uint16_t> shortIndices;
+
+        std::vector<Meshlet> meshlets;
+        std::vector<uint32_t> meshletVertices;
+        std::vector<uint8_t> meshletTriangles;
+
+        // lod 0 is the full index range, coarser lods follow it in the same index buffer
+        std::vector<MeshLod> lods;
+
+        // gpu ready streams, point either into the vectors above or into the mapped cache file, use these to read the mesh
+        const void* vertexData = nullptr;
+        const void* indexData = nullptr;
+        size_t vertexCount = 0;
+        size_t indexCount = 0;
+        size_t vertexSize = 0;
+        size_t indexSize = 0;
+
+        // meshlets index into the vertex stream, meshletTriangles holds 3 local vertex indices per triangle
+        const void* meshletData = nullptr;
+        const void* meshletVertexData = nullptr;
+        const void* meshletTriangleData = nullptr;
+        size_t meshletCount = 0;
+        size_t meshletVertexCount = 0;
+        size_t meshletTriangleSize = 0;
+
+        // xyz is the offset and w the scale that dequantize positions, identity for full precision vertices
+        glm::vec4 positionTransform = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+        // center and radius of a sphere enclosing the dequantized positions
+        glm::vec4 boundingSphere = glm::vec4(0.0f);
+
+        MappedFile cache;
+    };
+
+    // bump whenever the cache layout or the processing in ParseObj changes
+    static const uint32_t kMeshCacheMagic = 0x48534d48; // 'HMSH'
+    static const uint32_t kMeshCacheVersion = 6;
+
+    // processing steps baked into a cached mesh, a cache built with different steps is rebuilt
+    enum MeshProcessingFlags
+    {
+        MeshProcessing_Optimized = 1 << 0,
+        MeshProcessing_Quantized = 1 << 1,
+        MeshProcessing_Meshlets = 1 << 2,
+        MeshProcessing_Lods = 1 << 3,
+    };
+
+    struct MeshCacheHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t vertexLayout;
+        uint32_t processing;
+        uint64_t sourceHash;
+        uint64_t vertexCount;
+        uint64_t indexCount;
+        uint32_t vertexSize;
+        uint32_t indexSize;
+        float positionTransform[4];
+        float boundingSphere[4];
+        float lodError;
+        uint32_t lodCount;
+        MeshLod lods[kMaxLods];
+        uint64_t meshletCount;
+        uint64_t meshletVertexCount;
+        uint64_t meshletTriangleSize;
+    };
+
+    // the processing options baked into a cached mesh, a cache written with other options is rebuilt
+    uint32_t MeshProcessingKey()
+    {
+        uint32_t processing = 0;
+
+        if (options.optimizeMeshes)
+            processing |= MeshProcessing_Optimized;
+
+        if (options.quantizeMeshes)
+            processing |= MeshProcessing_Quantized;
+
+        if (options.meshlets)
+            processing |= MeshProcessing_Meshlets;
+
+        if (options.lods)
+            processing |= MeshProcessing_Lods;
+
+        return processing;
+    }
+
+    // changes whenever a field of Vertex is added, resized or moved
+    uint32_t VertexLayoutKey()
+    {
+        uint32_t fields[] =
+        {
+            uint32_t(sizeof(Vertex)),
+            uint32_t(offsetof(Vertex, vx)), uint32_t(offsetof(Vertex, nx)), uint32_t(offsetof(Vertex, tu)),
+            uint32_t(sizeof(Vertex::vx)), uint32_t(sizeof(Vertex::nx)), uint32_t(sizeof(Vertex::tu)),
+            uint32_t(sizeof(QuantizedVertex)),
+            uint32_t(offsetof(QuantizedVertex, vx)), uint32_t(offsetof(QuantizedVertex, nu)), uint32_t(offsetof(QuantizedVertex, tu)),
+            uint32_t(sizeof(Meshlet)), uint32_t(kMeshletMaxVertices), uint32_t(kMeshletMaxTriangles),
+        };
+
+        return uint32_t(hashBytes(fields, sizeof(fields)));
+    }
+
+    bool LoadMeshCache(Mesh& result, const char* cachePath, uint64_t sourceHash)
+    {
+        MappedFile file;
+        if (!mapFile(file, cachePath))
+            return false;
+
+        MeshCacheHeader header = {};
+        if (file.size >= sizeof(header))
+            memcpy(&header, file.data, sizeof(header));
+
+        // the counts come from the file, so every section is bounded by the bytes left before its size is computed and can't overflow
+        uint64_t remaining = file.size >= sizeof(header) ? file.size - sizeof(header) : 0;
+
+        auto takeSection = [&](uint64_t count, uint64_t elementSize)
+        {
+            if (elementSize != 0 && count > remaining / elementSize)
+                return false;
+
+            remaining -= count * elementSize;
+            return true;
+        };
+
+        bool sizeValid = file.size >= sizeof(header) && takeSection(header.vertexCount, header.vertexSize) && takeSection(header.indexCount, header.indexSize) &&
+            takeSection(header.meshletCount, sizeof(Meshlet)) && takeSection(header.meshletVertexCount, sizeof(uint32_t)) && takeSection(header.meshletTriangleSize, 1) && remaining == 0;
+
+        if (!sizeValid || header.magic != kMeshCacheMagic || header.version != kMeshCacheVersion ||
+            header.vertexLayout != VertexLayoutKey() || header.processing != MeshProcessingKey() || header.sourceHash != sourceHash ||
+            header.lodError != (options.lods ? options.lodError : 0.0f) || header.lodCount == 0 || header.lodCount > kMaxLods)
+        {
+            unmapFile(file);
+            return false;
+        }
+
+        const char* payload = static_cast<const char*>(file.data) + sizeof(header);
+
+        result.cache = file;
+        result.vertexData = payload;
+        result.indexData = payload + header.vertexCount * header.vertexSize;
+        result.meshletData = static_cast<const char*>(result.indexData) + header.indexCount * header.indexSize;
+        result.meshletVertexData = static_cast<const char*>(result.meshletData) + header.meshletCount * sizeof(Meshlet);
+        result.meshletTriangleData = static_cast<const char*>(result.meshletVertexData) + header.meshletVertexCount * sizeof(uint32_t);
+        result.vertexCount = size_t(header.vertexCount);
+        result.indexCount = size_t(header.indexCount);
+        result.vertexSize = header.vertexSize;
+        result.indexSize = header.indexSize;
+        result.meshletCount = size_t(header.meshletCount);
+        result.meshletVertexCount = size_t(header.meshletVertexCount);
+        result.meshletTriangleSize = size_t(header.meshletTriangleSize);
+        result.positionTransform = glm::vec4(header.positionTransform[0], header.positionTransform[1], header.positionTransform[2], header.positionTransform[3]);
+        result.boundingSphere = glm::vec4(header.boundingSphere[0], header.boundingSphere[1], header.boundingSphere[2], header.boundingSphere[3]);
+        result.lods.assign(header.lods, header.lods + header.lodCount);
+
+        return true;
+    }
+
+    void SaveMeshCache(const Mesh& mesh, const char* cachePath, uint64_t sourceHash)
+    {
+        MeshCacheHeader header = {};
+        header.magic = kMeshCacheMagic;
+        header.version = kMeshCacheVersion;
+        header.vertexLayout = VertexLayoutKey();
+        header.processing = MeshProcessingKey();
+        header.sourceHash = sourceHash;
+        header.vertexCount = mesh.vertexCount;
+        header.indexCount = mesh.indexCount;
+        header.vertexSize = uint32_t(mesh.vertexSize);
+        header.indexSize = uint32_t(mesh.indexSize);
+        memcpy(header.positionTransform, &mesh.positionTransform, sizeof(header.positionTransform));
+        memcpy(header.boundingSphere, &mesh.boundingSphere, sizeof(header.boundingSphere));
+        header.lodError = options.lods ? options.lodError : 0.0f;
+        header.lodCount = uint32_t(mesh.lods.size());
+        memcpy(header.lods, mesh.lods.data(), mesh.lods.size() * sizeof(MeshLod));
+        header.meshletCount = mesh.meshletCount;
+        header.meshletVertexCount = mesh.meshletVertexCount;
+        header.meshletTriangleSize = mesh.meshletTriangleSize;
+
+        // write to a temporary file first so a crash never leaves a truncated cache behind
+        std::string tempPath = std::string(cachePath) + ".tmp";
+
+        FILE* file = fopen(tempPath.c_str(), "wb");
+        if (!file)
+        {
+            std::cout << "Can't write mesh cache " << cachePath << std::endl;
+            return;
+        }
+
+        bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+        written = written && fwrite(mesh.vertexData, mesh.vertexSize, mesh.vertexCount, file) == mesh.vertexCount;
+        written = written && fwrite(mesh.indexData, mesh.indexSize, mesh.indexCount, file) == mesh.indexCount;
+        written = written && fwrite(mesh.meshletData, sizeof(Meshlet), mesh.meshletCount, file) == mesh.meshletCount;
+        written = written && fwrite(mesh.meshletVertexData, sizeof(uint32_t), mesh.meshletVertexCount, file) == mesh.meshletVertexCount;
+        written = written && fwrite(mesh.meshletTriangleData, 1, mesh.meshletTriangleSize, file) == mesh.meshletTriangleSize;
+        written = closeFileSynced(file) && written;
+
+        if (!written || !replaceFile(tempPath.c_str(), cachePath))
+        {
+            remove(tempPath.c_str());
+            std::cout << "Can't write mesh cache " << cachePath << std::endl;
+        }
+    }
+
+    bool LoadMesh(Mesh& result, const char* path)
+    {
+        TRACE_ZONE("LoadMesh");
+
+        auto loadBegin = std::chrono::high_resolution_clock::now();
+
+        // the cache is keyed by the source contents so hashing is the only work done on the OBJ when the cache is valid
+        MappedFile source;
+        if (!mapFile(source, path))
+        {
+            std::cerr << "Can't open mesh " << path << std::endl;
+            return false;
+        }
+
+        uint64_t sourceHash = hashBytes(source.data, source.size);
+
+        std::string cachePath = std::string(path) + ".cache";
+
+        bool cached = options.meshCache && LoadMeshCache(result, cachePath.c_str(), sourceHash);
+
+        if (cached)
+            unmapFile(source);
+
+        if (!cached)
+        {
+            auto parseBegin = std::chrono::high_resolution_clock::now();
+
+            bool parsed = options.parallelObjParser ? ParseObjParallel(result, path, source) : ParseObj(result, path);
+
+            auto parseEnd = std::chrono::high_resolution_clock::now();
+
+            double parseTime = std::chrono::duration<double, std::milli>(parseEnd - parseBegin).count();
+            double sourceSize = double(source.size) / (1024 * 1024);
+
+            unmapFile(source);
+
+            if (!parsed)
+                return false;
+
+            printf("Parsed %s (%.1f MB) with %s in %.2f ms: %.1f MB/s, peak RSS %.1f MB\n", path, sourceSize,
+                options.parallelObjParser ? "parallel parser" : "tinyobjloader", parseTime, sourceSize / (parseTime * 1e-3),
+                double(getPeakMemoryUsage()) / (1024 * 1024));
+
+            if (options.optimizeMeshes)
+                OptimizeMesh(result, path);
+
+            // meshlets cover the full detail index range only
+            if (options.meshlets)
+                BuildMeshlets(result, path);
+
+            if (options.lods)
+                BuildLods(result, path);
+
+            if (options.quantizeMeshes)
+                QuantizeMesh(result, path);
+
+            FinalizeMesh(result);
+
+            if (options.meshCache)
+                SaveMeshCache(result, cachePath.c_str(), sourceHash);
+        }
+
+        auto loadEnd = std::chrono::high_resolution_clock::now();
+
+        printf("Loaded %s%s: %zu vertices, %zu indices, %zu meshlets in %.2f ms\n", path, cached ? " from cache" : "",
+            result.vertexCount, result.indexCount, result.meshletCount, std::chrono::duration<double, std::milli>(loadEnd - loadBegin).count());
+
+        return true;
+    }
+
+    void PrintMeshStatistics(const char* stage, const Mesh& mesh)
+    {
+        // cache size and warp size modelled after a typical desktop gpu
+        meshopt_VertexCacheStatistics vcs = meshopt_analyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size(), 16, 0, 0);
+        meshopt_OverdrawStatistics os = meshopt_analyzeOverdraw(mesh.indices.data(), mesh.indices.size(), &mesh.vertices[0].vx, mesh.vertices.size(), sizeof(Vertex));
+        meshopt_VertexFetchStatistics vfs = meshopt_analyzeVertexFetch(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size(), sizeof(Vertex));
+
+        printf("  %-6s ACMR %.3f, ATVR %.3f, overdraw %.3f, overfetch %.3f\n", stage, vcs.acmr, vcs.atvr, os.overdraw, vfs.overfetch);
+    }
+
+    // post-transform cache first, then overdraw within the cache friendly order and finally vertex fetch which has to follow the final index order
+    void OptimizeMesh(Mesh& mesh, const char* path)
+    {
+        if (mesh.indices.empty())
+            return;
+
+        auto optimizeBegin = std::chrono::high_resolution_clock::now();
+
+        printf("Optimizing %s:\n", path);
+        PrintMeshStatistics("before", mesh);
+
+        size_t indexCount = mesh.indices.size();
+        size_t vertexCount = mesh.vertices.size();
+
+        meshopt_optimizeVertexCache(mesh.indices.data(), mesh.indices.data(), indexCount, vertexCount);
+
+        // allow up to 5% worse ACMR to get better overdraw
+        meshopt_optimizeOverdraw(mesh.indices.data(), mesh.indices.data(), indexCount, &mesh.vertices[0].vx, vertexCount, sizeof(Vertex), 1.05f);
+
+        size_t fetchVertexCount = meshopt_optimizeVertexFetch(mesh.vertices.data(), mesh.indices.data(), indexCount, mesh.vertices.data(), vertexCount, sizeof(Vertex));
+        mesh.vertices.resize(fetchVertexCount);
+
+        auto optimizeEnd = std::chrono::high_resolution_clock::now();
+
+        PrintMeshStatistics("after", mesh);
+        printf("  optimized in %.2f ms\n", std::chrono::duration<double, std::milli>(optimizeEnd - optimizeBegin).count());
+    }
+
+    // splits the index buffer into meshlets with bounding spheres and normal cones for per meshlet frustum and backface culling
+    void BuildMeshlets(Mesh& mesh, const char* path)
+    {
+        if (mesh.indices.empty())
+            return;
+
+        auto buildBegin = std::chrono::high_resolution_clock::now();
+
+        size_t maxMeshlets = meshopt_buildMeshletsBound(mesh.indices.size(), kMeshletMaxVertices, kMeshletMaxTriangles);
+
+        std::vector<meshopt_Meshlet> meshlets(maxMeshlets);
+        std::vector<uint32_t> meshletVertices(maxMeshlets * kMeshletMaxVertices);
+        std::vector<uint8_t> meshletTriangles(maxMeshlets * kMeshletMaxTriangles * 3);
+
+        // a small cone weight trades a bit of vertex reuse for tighter normal cones
+        size_t meshletCount = meshopt_buildMeshlets(meshlets.data(), meshletVertices.data(), meshletTriangles.data(), mesh.indices.data(), mesh.indices.size(),
+            &mesh.vertices[0].vx, mesh.vertices.size(), sizeof(Vertex), kMeshletMaxVertices, kMeshletMaxTriangles, 0.25f);
+
+        const meshopt_Meshlet& last = meshlets[meshletCount - 1];
+
+        meshletVertices.resize(last.vertex_offset + last.vertex_count);
+        meshletTriangles.resize(last.triangle_offset + ((last.triangle_count * 3 + 3) & ~3));
+
+        mesh.meshlets.resize(meshletCount);
+
+        for (size_t i = 0; i < meshletCount; ++i)
+        {
+            const meshopt_Meshlet& m = meshlets[i];
+
+            meshopt_Bounds bounds = meshopt_computeMeshletBounds(&meshletVertices[m.vertex_offset], &meshletTriangles[m.triangle_offset], m.triangle_count,
+                &mesh.vertices[0].vx, mesh.vertices.size(), sizeof(Vertex));
+
+            Meshlet& result = mesh.meshlets[i];
+            memcpy(result.center, bounds.center, sizeof(result.center));
+            result.radius = bounds.radius;
+            memcpy(result.coneAxis, bounds.cone_axis_s8, sizeof(result.coneAxis));
+            result.coneCutoff = bounds.cone_cutoff_s8;
+            result.vertexOffset = m.vertex_offset;
+            result.triangleOffset = m.triangle_offset;
+            result.vertexCount = uint8_t(m.vertex_count);
+            result.triangleCount = uint8_t(m.triangle_count);
+            result.padding = 0;
+        }
+
+        mesh.meshletVertices.swap(meshletVertices);
+        mesh.meshletTriangles.swap(meshletTriangles);
+
+        auto buildEnd = std::chrono::high_resolution_clock::now();
+
+        printf("Built %zu meshlets for %s (%.1f triangles per meshlet) in %.2f ms\n", meshletCount, path,
+            double(mesh.indices.size() / 3) / double(meshletCount), std::chrono::duration<double, std::milli>(buildEnd - buildBegin).count());
+    }
+
+    // appends progressively simplified copies of the index buffer, each lod halves the triangle count of the previous one until the error target stops it
+    void BuildLods(Mesh& mesh, const char* path)
+    {
+        if (mesh.indices.empty())
+            return;
+
+        auto buildBegin = std::chrono::high_resolution_clock::now();
+
+        // converts meshoptimizer's relative errors to mesh space distances
+        float scale = meshopt_simplifyScale(&mesh.vertices[0].vx, mesh.vertices.size(), sizeof(Vertex));
+
+        std::vector<uint32_t> lodIndices = mesh.indices;
+        float error = 0.0f;
+
+        mesh.lods.clear();
+        mesh.lods.push_back({ 0, uint32_t(mesh.indices.size()), 0.0f });
+
+        while (mesh.lods.size() < kMaxLods)
+        {
+            size_t targetIndexCount = lodIndices.size() / 6 * 3;
+            size_t maxIndexCount = lodIndices.size() * 3 / 4;
+
+            std::vector<uint32_t> simplified(lodIndices.size());
+            float lodError = 0.0f;
+
+            size_t indexCount = meshopt_simplify(simplified.data(), lodIndices.data(), lodIndices.size(), &mesh.vertices[0].vx, mesh.vertices.size(), sizeof(Vertex),
+                targetIndexCount, options.lodError, 0, &lodError);
+
+            // attribute seams can stall topology preserving simplification, the sloppy simplifier ignores topology and still honors the error target
+            if (indexCount > maxIndexCount)
+                indexCount = meshopt_simplifySloppy(simplified.data(), lodIndices.data(), lodIndices.size(), &mesh.vertices[0].vx, mesh.vertices.size(), sizeof(Vertex),
+                    targetIndexCount, options.lodError, &lodError);
+
+            if (indexCount == 0 || indexCount > maxIndexCount)
+                break;
+
+            simplified.resize(indexCount);
+            meshopt_optimizeVertexCache(simplified.data(), simplified.data(), indexCount, mesh.vertices.size());
+
+            // every lod is simplified from the previous one so the errors add up
+            error += lodError * scale;
+
+            mesh.lods.push_back({ uint32_t(mesh.indices.size()), uint32_t(indexCount), error });
+            mesh.indices.insert(mesh.indices.end(), simplified.begin(), simplified.end());
+
+            lodIndices.swap(simplified);
+        }
+
+        auto buildEnd = std::chrono::high_resolution_clock::now();
+
+        printf("Built %zu lods for %s in %.2f ms:\n", mesh.lods.size(), path, std::chrono::duration<double, std::milli>(buildEnd - buildBegin).count());
+
+        for (size_t i = 0; i < mesh.lods.size(); ++i)
+            printf("  lod %zu: %u triangles, error %f\n", i, mesh.lods[i].indexCount / 3, mesh.lods[i].error);
+    }
+
+    // octahedral mapping of a unit vector onto [-1, 1]^2, see "A Survey of Efficient Representations for Independent Unit Vectors"
+    static glm::vec2 EncodeOctahedral(glm::vec3 n)
+    {
+        n /= std::max(fabsf(n.x) + fabsf(n.y) + fabsf(n.z), 1e-6f);
+
+        glm::vec2 e = glm::vec2(n.x, n.y);
+
+        if (n.z < 0.0f)
+        {
+            e.x = (1.0f - fabsf(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+            e.y = (1.0f - fabsf(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+        }
+
+        return e;
+    }
+
+    void QuantizeMesh(Mesh& mesh, const char* path)
+    {
+        if (mesh.vertices.empty())
+            return;
+
+        glm::vec3 minPosition = glm::vec3(mesh.vertices[0].vx, mesh.vertices[0].vy, mesh.vertices[0].vz);
+        glm::vec3 maxPosition = minPosition;
+
+        for (const Vertex& v : mesh.vertices)
+        {
+            minPosition = glm::min(minPosition, glm::vec3(v.vx, v.vy, v.vz));
+            maxPosition = glm::max(maxPosition, glm::vec3(v.vx, v.vy, v.vz));
+        }
+
+        // a uniform scale keeps the quantization grid square, which avoids stretching errors on thin meshes
+        glm::vec3 extent = maxPosition - minPosition;
+        float scale = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-6f));
+
+        mesh.positionTransform = glm::vec4(minPosition, scale);
+        mesh.quantizedVertices.resize(mesh.vertices.size());
+
+        for (size_t i = 0; i < mesh.vertices.size(); ++i)
+        {
+            const Vertex& v = mesh.vertices[i];
+            QuantizedVertex& q = mesh.quantizedVertices[i];
+
+            q.vx = uint16_t(meshopt_quantizeUnorm((v.vx - minPosition.x) / scale, 16));
+            q.vy = uint16_t(meshopt_quantizeUnorm((v.vy - minPosition.y) / scale, 16));
+            q.vz = uint16_t(meshopt_quantizeUnorm((v.vz - minPosition.z) / scale, 16));
+
+            glm::vec3 normal = glm::vec3(v.nx, v.ny, v.nz) / 127.0f - 1.0f;
+            glm::vec2 octahedral = EncodeOctahedral(normal);
+
+            q.nu = int8_t(meshopt_quantizeSnorm(octahedral.x, 8));
+            q.nv = int8_t(meshopt_quantizeSnorm(octahedral.y, 8));
+
+            q.tu = meshopt_quantizeHalf(v.tu);
+            q.tv = meshopt_quantizeHalf(v.tv);
+        }
+
+        // 16 bit indices can address every vertex
+        if (mesh.vertices.size() <= 65536)
+            mesh.shortIndices.assign(mesh.indices.begin(), mesh.indices.end());
+
+        size_t before = mesh.vertices.size() * sizeof(Vertex) + mesh.indices.size() * sizeof(uint32_t);
+        size_t after = mesh.quantizedVertices.size() * sizeof(QuantizedVertex) +
+            mesh.indices.size() * (mesh.shortIndices.empty() ? sizeof(uint32_t) : sizeof(uint16_t));
+
+        printf("Quantized %s: %.2f MB -> %.2f MB of geometry\n", path, double(before) / (1024 * 1024), double(after) / (1024 * 1024));
+    }
+
+    // points the gpu ready streams at the most compact representation built for the mesh
+    void FinalizeMesh(Mesh& mesh)
+    {
+        if (!mesh.quantizedVertices.empty())
+        {
+            mesh.vertexData = mesh.quantizedVertices.data();
+            mesh.vertexSize = sizeof(QuantizedVertex);
+        }
+        else
+        {
+            mesh.vertexData = mesh.vertices.data();
+            mesh.vertexSize = sizeof(Vertex);
+        }
+
+        if (!mesh.shortIndices.empty())
+        {
+            mesh.indexData = mesh.shortIndices.data();
+            mesh.indexSize = sizeof(uint16_t);
+        }
+        else
+        {
+            mesh.indexData = mesh.indices.data();
+            mesh.indexSize = sizeof(uint32_t);
+        }
+
+        mesh.vertexCount = mesh.vertices.size();
+        mesh.indexCount = mesh.indices.size();
+
+        if (mesh.lods.empty())
+            mesh.lods.push_back({ 0, uint32_t(mesh.indices.size()), 0.0f });
+
+        mesh.meshletData = mesh.meshlets.data();
+        mesh.meshletVertexData = mesh.meshletVertices.data();
+        mesh.meshletTriangleData = mesh.meshletTriangles.data();
+        mesh.meshletCount = mesh.meshlets.size();
+        mesh.meshletVertexCount = mesh.meshletVertices.size();
+        mesh.meshletTriangleSize = mesh.meshletTriangles.size();
+
+        // sphere around the bounding box center, not minimal but cheap and good enough for culling
+        if (!mesh.vertices.empty())
+        {
+            glm::vec3 minPosition = glm::vec3(mesh.vertices[0].vx, mesh.vertices[0].vy, mesh.vertices[0].vz);
+            glm::vec3 maxPosition = minPosition;
+
+            for (const Vertex& v : mesh.vertices)
+            {
+                minPosition = glm::min(minPosition, glm::vec3(v.vx, v.vy, v.vz));
+                maxPosition = glm::max(maxPosition, glm::vec3(v.vx, v.vy, v.vz));
+            }
+
+            glm::vec3 center = (minPosition + maxPosition) * 0.5f;
+            float radius = 0.0f;
+
+            for (const Vertex& v : mesh.vertices)
+                radius = std::max(radius, glm::length(glm::vec3(v.vx, v.vy, v.vz) - center));
+
+            mesh.boundingSphere = glm::vec4(center, radius);
+        }
+    }
+
+    void FreeMesh(Mesh& mesh)
+    {
+        unmapFile(mesh.cache);
+
+        mesh = Mesh();
+    }
+
+    // per object data, the vertex shaders read it as instance data through gl_InstanceIndex and the culling shaders cull it, must match Object in culling.glsl and the vertex shaders
+    struct Object
+    {
+        glm::mat4 model;
+        glm::vec4 boundingSphere; // world space
+        glm::vec4 tint;
+        uint32_t lodOffset; // first lod of the object's mesh in the scene lod buffer
+        uint32_t lodCount;
+        int32_t vertexOffset;
+        uint32_t textureIndex;
+    };
+
+    static_assert(sizeof(Object) == 112, "Object must match the std430 layout in the shaders");
+
+    // size of the texture array in triangle.frag.glsl
+    static const uint32_t kMaxTextures = 8;
+
+    // textures the scene objects pick from by textureIndex: the loaded texture and generated checkerboards
+    static const uint32_t kSceneTextureCount = 4;
+    static const uint32_t kCheckerSize = 64;
+
+    static_assert(kSceneTextureCount <= kMaxTextures, "The scene textures must fit the texture array");
+
+    // a square grid of copies of the mesh turned by pseudo random angles around the up axis, a single object sits at the origin unrotated and untinted
+    std::vector<Object> CreateScene(const Mesh& mesh, uint32_t count, uint32_t textureCount, float& sceneRadius)
+    {
+        uint32_t side = uint32_t(ceilf(sqrtf(float(count))));
+        float spacing = mesh.boundingSphere.w * 2.5f;
+        glm::vec3 center = glm::vec3(mesh.boundingSphere);
+
+        std::vector<Object> objects(count);
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            float x = (float(i % side) - float(side - 1) * 0.5f) * spacing;
+            float y = (float(i / side) - float(side - 1) * 0.5f) * spacing;
+            uint64_t random = hashBytes(&i, sizeof(i));
+            float yaw = count == 1 ? 0.0f : float(random % 360);
+
+            Object& object = objects[i];
+            object.model = glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(x, y, 0.0f)), glm::radians(yaw), glm::vec3(0.0f, 0.0f, 1.0f));
+            object.boundingSphere = glm::vec4(glm::vec3(object.model * glm::vec4(center, 1.0f)), mesh.boundingSphere.w);
+            object.lodOffset = 0;
+            object.lodCount = uint32_t(mesh.lods.size());
+            object.vertexOffset = 0;
+
+            // bright tints keep the texture recognizable
+            glm::vec3 tint = glm::vec3(float((random >> 16) & 255), float((random >> 24) & 255), float((random >> 32) & 255)) / 255.0f;
+            object.tint = count == 1 ? glm::vec4(1.0f) : glm::vec4(glm::mix(glm::vec3(1.0f), tint, 0.5f), 1.0f);
+            object.textureIndex = i % textureCount;
+        }
+
+        sceneRadius = std::max(float(side) * spacing * 0.5f, mesh.boundingSphere.w);
+
+        return objects;
+    }
+
+    // the coarsest lod whose error projects to less than a pixel threshold, lodScale is the projection scale in pixels divided by that threshold
+    uint32_t SelectLod(const MeshLod* lods, const Object& object, glm::vec3 cameraPosition, float lodScale)
+    {
+        float distance = std::max(glm::length(glm::vec3(object.boundingSphere) - cameraPosition) - object.boundingSphere.w, 0.0f);
+
+        uint32_t lod = 0;
+
+        for (uint32_t i = 1; i < object.lodCount; ++i)
+            if (lods[object.lodOffset + i].error * lodScale <= distance)
+                lod = i;
+
+        return lod;
+    }
+
+    struct TextureLevel
+    {
+        const void* data;
+        size_t size;
+    };
+
+    struct Texture
+    {
+        VkFormat format;
+        uint32_t imageWidth;
+        uint32_t imageHeight;
+        uint32_t imageSize; // bytes of all stored levels
+
+        // level 0 first, decoded images only have level 0 and get the rest of their chain on upload
+        std::vector<TextureLevel> levels;
+
+        // storage the levels point into, depending on where the texture came from
+        stbi_uc* pixels = nullptr;
+        MappedFile file;
+        std::vector<uint8_t> decoded;
+    };
+
+    // attribute indices of one triangle corner, -1 when the attribute is missing
+    struct ObjCorner
+    {
+        int32_t v, vt, vn;
+    };
+
+    // a line aligned range of the OBJ parsed by one thread
+    struct ObjChunk
+    {
+        const char* begin;
+        const char* end;
+
+        // counts from the first pass, offsets into the shared arrays are computed from them before the second pass
+        size_t positions, texcoords, normals, corners;
+        size_t positionBase, texcoordBase, normalBase, cornerBase;
+
+        bool error;
+    };
+
+    // unique vertices of the shard of the hash space owned by one thread
+    struct VertexShard
+    {
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> table; // open addressing, vertex id + 1, 0 is empty
+        size_t base;
+    };
+
+    static uint32_t HashVertex(const Vertex& v)
+    {
+        static_assert(sizeof(Vertex) == 24, "HashVertex expects a tightly packed 24 byte vertex");
+
+        uint64_t words[3];
+        memcpy(words, &v, sizeof(words));
+
+        uint64_t h = words[0] * 0x9e3779b97f4a7c15ull ^ words[1] * 0xc2b2ae3d27d4eb4full ^ words[2] * 0x165667b19e3779f9ull;
+        h ^= h >> 29;
+        h *= 0xbf58476d1ce4e5b9ull;
+        h ^= h >> 32;
+
+        return uint32_t(h);
+    }
+
+    static uint32_t InsertVertex(VertexShard& shard, const Vertex& v, uint32_t hash)
+    {
+        // keep the load factor under 1/2 so probe sequences stay short
+        if ((shard.vertices.size() + 1) * 2 > shard.table.size())
+        {
+            std::vector<uint32_t> table(std::max(size_t(1024), shard.table.size() * 2), 0);
+            size_t mask = table.size() - 1;
+
+            for (size_t id = 0; id < shard.vertices.size(); ++id)
+            {
+                size_t slot = HashVertex(shard.vertices[id]) & mask;
+                while (table[slot])
+                    slot = (slot + 1) & mask;
+
+                table[slot] = uint32_t(id + 1);
+            }
+
+            shard.table.swap(table);
+        }
+
+        size_t mask = shard.table.size() - 1;
+
+        for (size_t slot = hash & mask; ; slot = (slot + 1) & mask)
+        {
+            uint32_t entry = shard.table[slot];
+
+            if (entry == 0)
+            {
+                shard.vertices.push_back(v);
+                shard.table[slot] = uint32_t(shard.vertices.size());
+                return uint32_t(shard.vertices.size() - 1);
+            }
+
+            if (memcmp(&shard.vertices[entry - 1], &v, sizeof(Vertex)) == 0)
+                return entry - 1;
+        }
+    }
+
+    static Vertex ObjVertex(const ObjCorner& corner, const std::vector<float>& positions, const std::vector<float>& texcoords, const std::vector<float>& normals)
+    {
+        // zero initialized so padding and missing attributes hash and compare consistently
+        Vertex v = {};
+
+        v.vx = positions[3 * size_t(corner.v) + 0];
+        v.vy = positions[3 * size_t(corner.v) + 1];
+        v.vz = positions[3 * size_t(corner.v) + 2];
+
+        if (corner.vn >= 0)
+        {
+            v.nx = uint8_t(normals[3 * size_t(corner.vn) + 0] * 127.0f + 127.0f);
+            v.ny = uint8_t(normals[3 * size_t(corner.vn) + 1] * 127.0f + 127.0f);
+            v.nz = uint8_t(normals[3 * size_t(corner.vn) + 2] * 127.0f + 127.0f);
+        }
+
+        if (corner.vt >= 0)
+        {
+            v.tu = texcoords[2 * size_t(corner.vt) + 0];
+            v.tv = 1.0f - texcoords[2 * size_t(corner.vt) + 1];
+        }
+
+        return v;
+    }
+
+    void CountObjChunk(ObjChunk& chunk)
+    {
+        const char* end = chunk.end;
+
+        for (const char* p = chunk.begin; p < end; p = objSkipLine(p, end))
+        {
+            p = objSkipSpace(p, end);
+
+            if (end - p < 2)
+                continue;
+
+            if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+                chunk.positions++;
+            else if (p[0] == 'v' && p[1] == 't')
+                chunk.texcoords++;
+            else if (p[0] == 'v' && p[1] == 'n')
+                chunk.normals++;
+            else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+            {
+                // count whitespace separated corners, polygons are fan triangulated
+                size_t faceCorners = 0;
+
+                for (const char* q = objSkipSpace(p + 1, end); q < end && *q != '\n'; q = objSkipSpace(q, end))
+                {
+                    while (q < end && *q != ' ' && *q != '\t' && *q != '\r' && *q != '\n')
+                        ++q;
+
+                    faceCorners++;
+                }
+
+                if (faceCorners >= 3)
+                    chunk.corners += (faceCorners - 2) * 3;
+            }
+        }
+    }
+
+    void ParseObjChunk(ObjChunk& chunk, std::vector<float>& positions, std::vector<float>& texcoords, std::vector<float>& normals, std::vector<ObjCorner>& corners)
+    {
+        const char* end = chunk.end;
+
+        size_t position = chunk.positionBase;
+        size_t texcoord = chunk.texcoordBase;
+        size_t normal = chunk.normalBase;
+        size_t corner = chunk.cornerBase;
+
+        for (const char* p = chunk.begin; p < end; p = objSkipLine(p, end))
+        {
+            p = objSkipSpace(p, end);
+
+            if (end - p < 2)
+                continue;
+
+            if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+            {
+                p = objParseFloat(p + 1, end, positions[3 * position + 0]);
+                p = objParseFloat(p, end, positions[3 * position + 1]);
+                p = objParseFloat(p, end, positions[3 * position + 2]);
+                position++;
+            }
+            else if (p[0] == 'v' && p[1] == 't')
+            {
+                p = objParseFloat(p + 2, end, texcoords[2 * texcoord + 0]);
+                p = objParseFloat(p, end, texcoords[2 * texcoord + 1]);
+                texcoord++;
+            }
+            else if (p[0] == 'v' && p[1] == 'n')
+            {
+                p = objParseFloat(p + 2, end, normals[3 * normal + 0]);
+                p = objParseFloat(p, end, normals[3 * normal + 1]);
+                p = objParseFloat(p, end, normals[3 * normal + 2]);
+                normal++;
+            }
+            else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+            {
+                ObjCorner first = {}, previous = {};
+                size_t faceCorners = 0;
+
+                for (p = objSkipSpace(p + 1, end); p < end && *p != '\n'; p = objSkipSpace(p, end))
+                {
+                    int64_t v = 0, vt = 0, vn = 0;
+
+                    const char* next = objParseInt(p, end, v);
+                    if (next == p)
+                    {
+                        chunk.error = true;
+                        return;
+                    }
+
+                    p = next;
+
+                    if (p < end && *p == '/')
+                    {
+                        p = objParseInt(p + 1, end, vt);
+
+                        if (p < end && *p == '/')
+                            p = objParseInt(p + 1, end, vn);
+                    }
+
+                    // relative indices refer to the attributes defined before this line, which the chunk bases account for
+                    ObjCorner current =
+                    {
+                        objResolveIndex(v, position, positions.size() / 3),
+                        objResolveIndex(vt, texcoord, texcoords.size() / 2),
+                        objResolveIndex(vn, normal, normals.size() / 3),
+                    };
+
+                    if (current.v < 0 || current.vt < -1 || current.vn < -1)
+                    {
+                        chunk.error = true;
+                        return;
+                    }
+
+                    if (faceCorners == 0)
+                        first = current;
+                    else if (faceCorners >= 2)
+                    {
+                        corners[corner++] = first;
+                        corners[corner++] = previous;
+                        corners[corner++] = current;
+                    }
+
+                    previous = current;
+                    faceCorners++;
+                }
+            }
+        }
+    }
+
+    // Splits the file into line aligned chunks that are counted and parsed in parallel straight into preallocated arrays,
+    // then deduplicates corners with a hash table per thread that owns a slice of the hash space.
+    // Unlike ParseObj this never materializes one Vertex per corner, the largest transient allocation is the corner list.
+    // All steps run on one pool so the threads are only started once per file.
+    bool ParseObjParallel(Mesh& result, const char* path, const MappedFile& source)
+    {
+        const size_t minChunkSize = 1 << 20;
+
+        const char* data = static_cast<const char*>(source.data);
+        size_t size = source.size;
+
+        uint32_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+        threadCount = uint32_t(std::min(size_t(threadCount), size / minChunkSize + 1));
+
+        std::vector<ObjChunk> chunks(threadCount);
+
+        for (uint32_t i = 0; i < threadCount; ++i)
+        {
+            // every chunk starts at the beginning of a line so no line is split between threads
+            const char* begin = data + size * i / threadCount;
+            if (i > 0)
+                begin = objSkipLine(begin - 1, data + size);
+
+            ObjChunk chunk = {};
+            chunk.begin = begin;
+            chunks[i] = chunk;
+
+            if (i > 0)
+                chunks[i - 1].end = begin;
+        }
+
+        chunks[threadCount - 1].end = data + size;
+
+        ThreadPool pool;
+        createThreadPool(pool, threadCount - 1, "obj parser");
+
+        runThreadPool(pool, threadCount, [&](uint32_t i) { CountObjChunk(chunks[i]); });
+
+        size_t positionCount = 0, texcoordCount = 0, normalCount = 0, cornerCount = 0;
+
+        for (ObjChunk& chunk : chunks)
+        {
+            chunk.positionBase = positionCount;
+            chunk.texcoordBase = texcoordCount;
+            chunk.normalBase = normalCount;
+            chunk.cornerBase = cornerCount;
+
+            positionCount += chunk.positions;
+            texcoordCount += chunk.texcoords;
+            normalCount += chunk.normals;
+            cornerCount += chunk.corners;
+        }
+
+        if (cornerCount > UINT32_MAX)
+        {
+            std::cerr << "Mesh " << path << " has too many indices" << std::endl;
+            return false;
+        }
+
+        std::vector<float> positions(positionCount * 3);
+        std::vector<float> texcoords(texcoordCount * 2);
+        std::vector<float> normals(normalCount * 3);
+        std::vector<ObjCorner> corners(cornerCount);
+
+        runThreadPool(pool, threadCount, [&](uint32_t i) { ParseObjChunk(chunks[i], positions, texcoords, normals, corners); });
+
+        for (const ObjChunk& chunk : chunks)
+        {
+            if (chunk.error)
+            {
+                std::cerr << "Malformed face in " << path << std::endl;
+                return false;
+            }
+        }
+
+        // high bits pick the shard, the table probes with the low bits
+        auto shardOf = [&](uint32_t hash) { return uint32_t((uint64_t(hash) * threadCount) >> 32); };
+
+        // indices first hold each corner's vertex hash, corners are reused to hold the shard local vertex id
+        result.indices.resize(cornerCount);
+
+        // shardOffsets[i * threadCount + s] first counts the corners in thread i's range that belong to shard s
+        std::vector<size_t> shardOffsets(size_t(threadCount) * threadCount, 0);
+
+        runThreadPool(pool, threadCount, [&](uint32_t i)
+        {
+            size_t* counts = &shardOffsets[size_t(i) * threadCount];
+
+            size_t begin = cornerCount * i / threadCount;
+            size_t end = cornerCount * (i + 1) / threadCount;
+
+            for (size_t c = begin; c < end; ++c)
+            {
+                uint32_t hash = HashVertex(ObjVertex(corners[c], positions, texcoords, normals));
+
+                result.indices[c] = hash;
+                counts[shardOf(hash)]++;
+            }
+        });
+
+        // the counts become offsets grouped by shard, then by thread, so every shard sees its corners in file order
+        std::vector<size_t> shardBegin(threadCount + 1);
+        size_t shardOffset = 0;
+
+        for (uint32_t s = 0; s < threadCount; ++s)
+        {
+            shardBegin[s] = shardOffset;
+
+            for (uint32_t i = 0; i < threadCount; ++i)
+            {
+                size_t count = shardOffsets[size_t(i) * threadCount + s];
+                shardOffsets[size_t(i) * threadCount + s] = shardOffset;
+                shardOffset += count;
+            }
+        }
+
+        shardBegin[threadCount] = shardOffset;
+
+        std::vector<uint32_t> shardCorners(cornerCount);
+
+        runThreadPool(pool, threadCount, [&](uint32_t i)
+        {
+            size_t* offsets = &shardOffsets[size_t(i) * threadCount];
+
+            size_t begin = cornerCount * i / threadCount;
+            size_t end = cornerCount * (i + 1) / threadCount;
+
+            for (size_t c = begin; c < end; ++c)
+                shardCorners[offsets[shardOf(result.indices[c])]++] = uint32_t(c);
+        });
+
+        std::vector<VertexShard> shards(threadCount);
+
+        runThreadPool(pool, threadCount, [&](uint32_t i)
+        {
+            VertexShard& shard = shards[i];
+
+            for (size_t k = shardBegin[i]; k < shardBegin[i + 1]; ++k)
+            {
+                size_t c = shardCorners[k];
+                uint32_t hash = result.indices[c];
+
+                uint32_t id = InsertVertex(shard, ObjVertex(corners[c], positions, texcoords, normals), hash);
+
+                corners[c].v = int32_t(id);
+                corners[c].vt = int32_t(i);
+            }
+
+            std::vector<uint32_t>().swap(shard.table);
+        });
+
+        std::vector<uint32_t>().swap(shardCorners);
+        std::vector<float>().swap(positions);
+        std::vector<float>().swap(texcoords);
+        std::vector<float>().swap(normals);
+
+        size_t vertexCount = 0;
+
+        for (VertexShard& shard : shards)
+        {
+            shard.base = vertexCount;
+            vertexCount += shard.vertices.size();
+        }
+
+        result.vertices.resize(vertexCount);
+
+        runThreadPool(pool, threadCount, [&](uint32_t i)
+        {
+            VertexShard& shard = shards[i];
+
+            if (!shard.vertices.empty())
+                memcpy(&result.vertices[shard.base], shard.vertices.data(), shard.vertices.size() * sizeof(Vertex));
+
+            std::vector<Vertex>().swap(shard.vertices);
+
+            size_t begin = cornerCount * i / threadCount;
+            size_t end = cornerCount * (i + 1) / threadCount;
+
+            for (size_t c = begin; c < end; ++c)
+                result.indices[c] = uint32_t(shards[corners[c].vt].base + corners[c].v);
+        });
+
+        std::vector<ObjCorner>().swap(corners);
+
+        // shards leave vertices grouped by hash, restore first use order for vertex fetch locality like meshopt_generateVertexRemap
+        std::vector<uint32_t> remap(vertexCount);
+        meshopt_optimizeVertexFetchRemap(remap.data(), result.indices.data(), cornerCount, vertexCount);
+        meshopt_remapIndexBuffer(result.indices.data(), result.indices.data(), cornerCount, remap.data());
+        meshopt_remapVertexBuffer(result.vertices.data(), result.vertices.data(), vertexCount, sizeof(Vertex), remap.data());
+
+        return true;
+    }
+
+    bool ParseObj(Mesh& result, const char* path)
+    {
+        // Load Model using tinyobjloader
+        tinyobj::ObjReaderConfig reader_config;
+        reader_config.mtl_search_path = "./"; // Path to material files
+        reader_config.triangulate = false;
+
+        tinyobj::ObjReader reader;
+
+        if (!reader.ParseFromFile(path, reader_config)) {
+            if (!reader.Error().empty()) {
+                std::cerr << "TinyObjReader: " << reader.Error();
+            }
+            return false;
+        }
+
+        if (!reader.Warning().empty()) {
+            std::cout << "TinyObjReader: " << reader.Warning();
+        }
+
+        auto& attrib = reader.GetAttrib();
+        auto& shapes = reader.GetShapes();
+        auto& materials = reader.GetMaterials();
+
+        uint32_t indexCount = 0;
+
+        for (int i = 0; i < shapes.size(); ++i)
+        {
+            indexCount += uint32_t(shapes[i].mesh.indices.size());
+        }
+
+        std::vector<Vertex> vertices(indexCount);
+        std::vector<uint32_t> indices(indexCount);
+
+        // Loop over shapes
+        for (size_t s = 0; s < shapes.size(); s++) {
+            // Loop over faces(polygon)
+            size_t index_offset = 0;
+            for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
+                size_t fv = size_t(shapes[s].mesh.num_face_vertices[f]);
+
+
+                // Loop over vertices in the face.
+                for (size_t v = 0; v < fv; v++) {
+                    Vertex& vert = vertices[index_offset + v];
+
+                    // access to vertex
+                    tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
+                    vert.vx = attrib.vertices[3 * size_t(idx.vertex_index) + 0];
+                    vert.vy = attrib.vertices[3 * size_t(idx.vertex_index) + 1];
+                    vert.vz = attrib.vertices[3 * size_t(idx.vertex_index) + 2];
+
+                    // Check if `normal_index` is zero or positive. negative = no normal data
+                    if (idx.normal_index >= 0) {
+                        vert.nx = uint8_t(attrib.normals[3 * size_t(idx.normal_index) + 0] * 127.0f + 127.0f);
+                        vert.ny = uint8_t(attrib.normals[3 * size_t(idx.normal_index) + 1] * 127.0f + 127.0f);
+                        vert.nz = uint8_t(attrib.normals[3 * size_t(idx.normal_index) + 2] * 127.0f + 127.0f);
+                    }
+
+                    // Check if `texcoord_index` is zero or positive. negative = no texcoord data
+                    if (idx.texcoord_index >= 0) {
+                        vert.tu = attrib.texcoords[2 * size_t(idx.texcoord_index) + 0];
+                        vert.tv = 1.0 - attrib.texcoords[2 * size_t(idx.texcoord_index) + 1];
+                    }
+
+                    // Optional: vertex colors
+                    // tinyobj::real_t red   = attrib.colors[3*size_t(idx.vertex_index)+0];
+                    // tinyobj::real_t green = attrib.colors[3*size_t(idx.vertex_index)+1];
+                    // tinyobj::real_t blue  = attrib.colors[3*size_t(idx.vertex_index)+2];
+                    
+                    indices[index_offset + v] = idx.vertex_index;
+                }
+                index_offset += fv;
+
+
+                // per-face material
+                //shapes[s].mesh.material_ids[f];
+            }
+        }
+
+        // Use meshoptimizer to get an optimized mesh
+        std::vector<uint32_t> remap(indexCount);
+        size_t vertexCount = meshopt_generateVertexRemap(remap.data(), 0, indexCount, vertices.data(), indexCount, sizeof(Vertex));
+
+        result.vertices.resize(vertexCount);
+        result.indices.resize(indexCount);
+
+        meshopt_remapVertexBuffer(result.vertices.data(), vertices.data(), indexCount, sizeof(Vertex), remap.data());
+        meshopt_remapIndexBuffer(result.indices.data(), 0, indexCount, remap.data());
+
+        return true;
+    }
+
+    // a .ktx2 file with the same name is loaded instead of the image when it is usable on this device
+    void LoadTexture(Texture& tex, const char* path) 
+    {
+        TRACE_ZONE("LoadTexture");
+
+        auto loadBegin = std::chrono::high_resolution_clock::now();
+
+        std::string ktx2Path = path;
+        ktx2Path = ktx2Path.substr(0, ktx2Path.find_last_of('.')) + ".ktx2";
+
+        bool compressed = options.ktx2 && LoadKtx2(tex, ktx2Path.c_str());
+
+        if (!compressed)
+        {
+            int texWidth, texHeight, texChannels;
+            stbi_uc* pixels = stbi_load(path, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+            uint32_t imageSize = texWidth * texHeight * 4;
+
+            if (!pixels) {
+                throw std::runtime_error("failed to load texture image!");
+            }
+
+            tex.format = VK_FORMAT_R8G8B8A8_UNORM;
+            tex.pixels = pixels;
+            tex.imageWidth = texWidth;
+            tex.imageHeight = texHeight;
+            tex.imageSize = imageSize;
+            tex.levels.push_back({ pixels, imageSize });
+        }
+
+        auto loadEnd = std::chrono::high_resolution_clock::now();
+
+        printf("Loaded %s: %ux%u %s, %zu levels, %.1f MB in %.2f ms\n", compressed ? ktx2Path.c_str() : path, tex.imageWidth, tex.imageHeight, FormatName(tex.format),
+            tex.levels.size(), double(tex.imageSize) / (1024 * 1024), std::chrono::duration<double, std::milli>(loadEnd - loadBegin).count());
+    }
+
+    void FreeTexture(Texture& tex)
+    {
+        if (tex.pixels)
+            stbi_image_free(tex.pixels);
+
+        if (tex.file.data)
+            unmapFile(tex.file);
+
+        tex = Texture();
+    }
+
+    bool IsUncompressedFormat(VkFormat format)
+    {
+        return format == VK_FORMAT_R8G8B8A8_UNORM || format == VK_FORMAT_R8G8B8A8_SRGB;
+    }
+
+    // bytes per 4x4 block of the compressed formats accepted in ktx2 files, uncompressed rgba8 counts as 1x1 blocks
+    bool GetFormatBlock(VkFormat format, uint32_t& blockSize, uint32_t& blockBytes)
+    {
+        blockSize = 4;
+
+        switch (format)
+        {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK:
+            blockBytes = 8;
+            return true;
+        case VK_FORMAT_BC7_UNORM_BLOCK:
+        case VK_FORMAT_BC7_SRGB_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+            blockBytes = 16;
+            return true;
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
+            blockSize = 1;
+            blockBytes = 4;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    const char* FormatName(VkFormat format)
+    {
+        switch (format)
+        {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK: case VK_FORMAT_BC1_RGB_SRGB_BLOCK: case VK_FORMAT_BC1_RGBA_UNORM_BLOCK: case VK_FORMAT_BC1_RGBA_SRGB_BLOCK: return "BC1";
+        case VK_FORMAT_BC7_UNORM_BLOCK: case VK_FORMAT_BC7_SRGB_BLOCK: return "BC7";
+        case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK: case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK: return "ETC2 RGB";
+        case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK: case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK: return "ETC2 RGB A1";
+        case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK: case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK: return "ETC2 RGBA";
+        case VK_FORMAT_R8G8B8A8_UNORM: case VK_FORMAT_R8G8B8A8_SRGB: return "RGBA8";
+        default: return "unknown format";
+        }
+    }
+
+    bool IsFormatSampleable(VkFormat format)
+    {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+
+        VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+
+        return (props.optimalTilingFeatures & required) == required;
+    }
+
+    // expands 5 or 6 bit channels so that 0 and the maximum map to 0 and 255
+    static uint8_t expandBits(uint32_t value, uint32_t bits)
+    {
+        return uint8_t((value << (8 - bits)) | (value >> (2 * bits - 8)));
+    }
+
+    // decodes a bc1 level into rgba8, used when the device can't sample bc formats
+    void DecodeBc1(uint8_t* dst, const uint8_t* src, uint32_t width, uint32_t height, bool alpha)
+    {
+        for (uint32_t by = 0; by < (height + 3) / 4; ++by)
+        {
+            for (uint32_t bx = 0; bx < (width + 3) / 4; ++bx, src += 8)
+            {
+                uint32_t c0 = src[0] | (src[1] << 8);
+                uint32_t c1 = src[2] | (src[3] << 8);
+                uint32_t bits = src[4] | (src[5] << 8) | (src[6] << 16) | (uint32_t(src[7]) << 24);
+
+                uint8_t palette[4][4] = {};
+
+                for (uint32_t i = 0; i < 2; ++i)
+                {
+                    uint32_t c = i == 0 ? c0 : c1;
+
+                    palette[i][0] = expandBits((c >> 11) & 31, 5);
+                    palette[i][1] = expandBits((c >> 5) & 63, 6);
+                    palette[i][2] = expandBits(c & 31, 5);
+                    palette[i][3] = 255;
+                }
+
+                // c0 <= c1 selects the three color mode where the last index is black, transparent for bc1 rgba
+                for (uint32_t k = 0; k < 3; ++k)
+                {
+                    palette[2][k] = uint8_t(c0 > c1 ? (2 * palette[0][k] + palette[1][k]) / 3 : (palette[0][k] + palette[1][k]) / 2);
+                    palette[3][k] = uint8_t(c0 > c1 ? (palette[0][k] + 2 * palette[1][k]) / 3 : 0);
+                }
+
+                palette[2][3] = 255;
+                palette[3][3] = c0 > c1 || !alpha ? 255 : 0;
+
+                for (uint32_t y = 0; y < 4 && by * 4 + y < height; ++y)
+                    for (uint32_t x = 0; x < 4 && bx * 4 + x < width; ++x)
+                        memcpy(&dst[((by * 4 + y) * width + bx * 4 + x) * 4], palette[(bits >> (2 * (y * 4 + x))) & 3], 4);
+            }
+        }
+    }
+
+    struct Ktx2Header
+    {
+        uint8_t identifier[12];
+        uint32_t vkFormat;
+        uint32_t typeSize;
+        uint32_t pixelWidth;
+        uint32_t pixelHeight;
+        uint32_t pixelDepth;
+        uint32_t layerCount;
+        uint32_t faceCount;
+        uint32_t levelCount;
+        uint32_t supercompressionScheme;
+
+        uint32_t dfdByteOffset;
+        uint32_t dfdByteLength;
+        uint32_t kvdByteOffset;
+        uint32_t kvdByteLength;
+        uint64_t sgdByteOffset;
+        uint64_t sgdByteLength;
+    };
+
+    struct Ktx2Level
+    {
+        uint64_t byteOffset;
+        uint64_t byteLength;
+        uint64_t uncompressedByteLength;
+    };
+
+    static_assert(sizeof(Ktx2Header) == 80, "Ktx2Header must match the KTX 2.0 file layout");
+
+    // maps a ktx2 file with a block compressed format and its precomputed mips, supercompressed (basis) files and arrays, cubes and 3d textures aren't supported
+    bool LoadKtx2(Texture& tex, const char* path)
+    {
+        static const uint8_t kKtx2Identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+        MappedFile file;
+        if (!mapFile(file, path))
+            return false;
+
+        Ktx2Header header = {};
+        if (file.size >= sizeof(header))
+            memcpy(&header, file.data, sizeof(header));
+
+        VkFormat format = VkFormat(header.vkFormat);
+        uint32_t levelCount = std::max(header.levelCount, 1u);
+        uint32_t blockSize = 0, blockBytes = 0;
+
+        if (file.size < sizeof(header) + levelCount * sizeof(Ktx2Level) || memcmp(header.identifier, kKtx2Identifier, sizeof(kKtx2Identifier)) != 0 ||
+            header.supercompressionScheme != 0 || header.pixelDepth > 1 || header.layerCount > 1 || header.faceCount != 1 ||
+            !GetFormatBlock(format, blockSize, blockBytes) || header.pixelWidth == 0 || header.pixelHeight == 0)
+        {
+            printf("Unsupported KTX2 file %s, decoding the original image instead\n", path);
+            unmapFile(file);
+            return false;
+        }
+
+        const Ktx2Level* levels = reinterpret_cast<const Ktx2Level*>(static_cast<const char*>(file.data) + sizeof(header));
+
+        for (uint32_t i = 0; i < levelCount; ++i)
+        {
+            uint32_t levelWidth = std::max(header.pixelWidth >> i, 1u);
+            uint32_t levelHeight = std::max(header.pixelHeight >> i, 1u);
+            uint64_t expectedSize = uint64_t((levelWidth + blockSize - 1) / blockSize) * ((levelHeight + blockSize - 1) / blockSize) * blockBytes;
+
+            // the offset is checked first so a huge offset can't wrap the end of the level around
+            if (levels[i].byteLength != expectedSize || levels[i].byteOffset > file.size || levels[i].byteLength > file.size - levels[i].byteOffset)
+            {
+                printf("Corrupted KTX2 file %s, decoding the original image instead\n", path);
+                unmapFile(file);
+                return false;
+            }
+        }
+
+        tex.format = format;
+        tex.imageWidth = header.pixelWidth;
+        tex.imageHeight = header.pixelHeight;
+        tex.imageSize = 0;
+
+        bool bc1 = format == VK_FORMAT_BC1_RGB_UNORM_BLOCK || format == VK_FORMAT_BC1_RGB_SRGB_BLOCK || format == VK_FORMAT_BC1_RGBA_UNORM_BLOCK || format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+
+        if (IsFormatSampleable(format))
+        {
+            // the levels are uploaded straight from the mapping
+            for (uint32_t i = 0; i < levelCount; ++i)
+            {
+                tex.levels.push_back({ static_cast<const char*>(file.data) + levels[i].byteOffset, size_t(levels[i].byteLength) });
+                tex.imageSize += uint32_t(levels[i].byteLength);
+            }
+
+            tex.file = file;
+            return true;
+        }
+
+        if (!bc1)
+        {
+            printf("Device can't sample %s textures, decoding the original image instead of %s\n", FormatName(format), path);
+            unmapFile(file);
+            return false;
+        }
+
+        // devices without bc support get the precomputed levels decoded to rgba8
+        bool srgb = format == VK_FORMAT_BC1_RGB_SRGB_BLOCK || format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+        bool alpha = format == VK_FORMAT_BC1_RGBA_UNORM_BLOCK || format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+
+        std::vector<size_t> offsets(levelCount);
+        size_t decodedSize = 0;
+
+        for (uint32_t i = 0; i < levelCount; ++i)
+        {
+            offsets[i] = decodedSize;
+            decodedSize += size_t(std::max(header.pixelWidth >> i, 1u)) * std::max(header.pixelHeight >> i, 1u) * 4;
+        }
+
+        tex.decoded.resize(decodedSize);
+        tex.format = srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+
+        for (uint32_t i = 0; i < levelCount; ++i)
+        {
+            uint32_t levelWidth = std::max(header.pixelWidth >> i, 1u);
+            uint32_t levelHeight = std::max(header.pixelHeight >> i, 1u);
+
+            DecodeBc1(&tex.decoded[offsets[i]], static_cast<const uint8_t*>(file.data) + levels[i].byteOffset, levelWidth, levelHeight, alpha);
+
+            tex.levels.push_back({ &tex.decoded[offsets[i]], size_t(levelWidth) * levelHeight * 4 });
+            tex.imageSize += uint32_t(tex.levels.back().size);
+        }
+
+        printf("Device can't sample BC1 textures, decoded %s on the cpu\n", path);
+
+        unmapFile(file);
+        return true;
+    }
+
+    // the stored levels, or a full chain generated on upload for uncompressed textures
+    uint32_t TextureMipLevels(const Texture& tex)
+    {
+        if (!options.mips)
+            return 1;
+
+        if (tex.levels.size() > 1 || !IsUncompressedFormat(tex.format))
+            return uint32_t(tex.levels.size());
+
+        return MipLevelCount(tex.imageWidth, tex.imageHeight);
+    }
+
+    enum AssetState
+    {
+        AssetState_Queued,
+        AssetState_Loading,
+        // loaded on the cpu, the render thread uploads it and makes it drawable
+        AssetState_Ready,
+        AssetState_Failed,
+    };
+
+    struct Asset
+    {
+        std::string path;
+        std::function<bool(const char* path)> load;
+        std::atomic<uint32_t> state;
+
+        // milliseconds since the loader was created, the worker writes them before publishing the state
+        double queueTime = 0.0;
+        double startTime = 0.0;
+        double endTime = 0.0;
+
+        // filled in by the render thread once the asset is uploaded
+        double uploadTime = 0.0;
+        uint32_t drawableFrame = ~0u;
+    };
+
+    struct AssetLoader
+    {
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::deque<Asset*> queue;
+        bool stopping = false;
+
+        std::vector<std::unique_ptr<Asset>> assets;
+        std::chrono::high_resolution_clock::time_point begin;
+
+        // assets that haven't started loading are dropped, the ones being loaded are finished first
+        void Stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+
+            wake.notify_all();
+
+            for (std::thread& worker : workers)
+                worker.join();
+
+            workers.clear();
+        }
+
+        // MainLoop can throw while assets are loading, the workers must not outlive the loader
+        ~AssetLoader()
+        {
+            Stop();
+        }
+    };
+
+    struct LoadProgress
+    {
+        uint32_t total;
+        uint32_t queued;
+        uint32_t loading;
+        uint32_t ready;
+        uint32_t failed;
+    };
+
+    double LoaderTime(const AssetLoader& loader)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - loader.begin).count();
+    }
+
+    void CreateAssetLoader(AssetLoader& loader, uint32_t threadCount)
+    {
+        loader.begin = std::chrono::high_resolution_clock::now();
+
+        for (uint32_t i = 0; i < threadCount; ++i)
+            loader.workers.emplace_back([this, &loader]() { AssetWorker(loader); });
+    }
+
+    void DestroyAssetLoader(AssetLoader& loader)
+    {
+        loader.Stop();
+    }
+
+    void RunAssetLoad(AssetLoader& loader, Asset& asset)
+    {
+        asset.startTime = LoaderTime(loader);
+        asset.state = AssetState_Loading;
+
+        bool loaded = false;
+
+        try
+        {
+            loaded = asset.load(asset.path.c_str());
+        }
+        catch (const std::exception& e)
+        {
+            printf("Failed to load %s: %s\n", asset.path.c_str(), e.what());
+        }
+
+        asset.endTime = LoaderTime(loader);
+        asset.state = loaded ? AssetState_Ready : AssetState_Failed;
+    }
+
+    void AssetWorker(AssetLoader& loader)
+    {
+        TRACE_THREAD_NAME("asset loader");
+
+        for (;;)
+        {
+            Asset* asset = nullptr;
+
+            {
+                std::unique_lock<std::mutex> lock(loader.mutex);
+                loader.wake.wait(lock, [&loader]() { return loader.stopping || !loader.queue.empty(); });
+
+                if (loader.stopping)
+                    return;
+
+                asset = loader.queue.front();
+                loader.queue.pop_front();
+            }
+
+            RunAssetLoad(loader, *asset);
+        }
+    }
+
+    // load runs on a worker and must only touch data owned by the asset, without workers it runs right away on the calling thread
+    Asset* LoadAssetAsync(AssetLoader& loader, const char* path, const std::function<bool(const char* path)>& load)
+    {
+        loader.assets.emplace_back(new Asset());
+
+        Asset* asset = loader.assets.back().get();
+        asset->path = path;
+        asset->load = load;
+        asset->state = AssetState_Queued;
+        asset->queueTime = LoaderTime(loader);
+
+        if (loader.workers.empty())
+        {
+            RunAssetLoad(loader, *asset);
+            return asset;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(loader.mutex);
+            loader.queue.push_back(asset);
+        }
+
+        loader.wake.notify_one();
+
+        return asset;
+    }
+
+    LoadProgress GetLoadProgress(const AssetLoader& loader)
+    {
+        LoadProgress progress = {};
+        progress.total = uint32_t(loader.assets.size());
+
+        for (const std::unique_ptr<Asset>& asset : loader.assets)
+        {
+            switch (asset->state)
+            {
+            case AssetState_Queued: progress.queued++; break;
+            case AssetState_Loading: progress.loading++; break;
+            case AssetState_Ready: progress.ready++; break;
+            case AssetState_Failed: progress.failed++; break;
+            }
+        }
+
+        return progress;
+    }
+
+    void PrintAssetTimings(const AssetLoader& loader)
+    {
+        printf("Loaded %zu assets on %zu loader threads in %.2f ms:\n", loader.assets.size(), loader.workers.size(), LoaderTime(loader));
+
+        for (const std::unique_ptr<Asset>& asset : loader.assets)
+        {
+            if (asset->state == AssetState_Failed)
+                printf("    %s: failed after %.2f ms\n", asset->path.c_str(), asset->endTime - asset->startTime);
+            else if (asset->drawableFrame == ~0u)
+                printf("    %s: queued %.2f ms, load %.2f ms, upload %.2f ms, not drawn yet\n", asset->path.c_str(),
+                    asset->startTime - asset->queueTime, asset->endTime - asset->startTime, asset->uploadTime);
+            else
+                printf("    %s: queued %.2f ms, load %.2f ms, upload %.2f ms, drawable at frame %u\n", asset->path.c_str(),
+                    asset->startTime - asset->queueTime, asset->endTime - asset->startTime, asset->uploadTime, asset->drawableFrame);
+        }
+    }
+
+    struct RegisteredPipeline
+    {
+        PipelineState state;
+        // written by the compiling worker before its asset is published as ready
+        VkPipeline pipeline = 0;
+        // null when the pipeline was compiled on the registering thread
+        Asset* compile = nullptr;
+    };
+
+    // pipelines keyed by the hash of their state, registering the same state twice returns the same pipeline
+    struct PipelineRegistry
+    {
+        VkPipelineCache cache = 0;
+        std::unordered_map<uint64_t, std::unique_ptr<RegisteredPipeline>> pipelines;
+    };
+
+    // with a loader the pipeline compiles on its workers through the shared cache and GetPipeline returns null until it is done,
+    // callers draw with a pipeline registered without a loader meanwhile
+    uint64_t RegisterPipeline(PipelineRegistry& registry, AssetLoader* loader, const char* name, const PipelineState& state)
+    {
+        uint64_t key = hashBytes(&state, sizeof(state));
+
+        // PipelineState has no padding, so memcmp tells a registered state from a colliding one, which probes the next key
+        for (auto it = registry.pipelines.find(key); it != registry.pipelines.end(); it = registry.pipelines.find(++key))
+            if (memcmp(&it->second->state, &state, sizeof(state)) == 0)
+                return key;
+
+        std::unique_ptr<RegisteredPipeline>& entry = registry.pipelines[key];
+        entry.reset(new RegisteredPipeline());
+        entry->state = state;
+
+        if (!loader)
+        {
+            entry->pipeline = CreatePipeline(registry.cache, state);
+            return key;
+        }
+
+        RegisteredPipeline* pipeline = entry.get();
+        VkPipelineCache cache = registry.cache;
+
+        pipeline->compile = LoadAssetAsync(*loader, name, [pipeline, cache, this](const char*)
+        {
+            pipeline->pipeline = CreatePipeline(cache, pipeline->state);
+            return true;
+        });
+
+        return key;
+    }
+
+    VkPipeline GetPipeline(PipelineRegistry& registry, uint64_t key, uint32_t frameIndex)
+    {
+        auto it = registry.pipelines.find(key);
+        if (it == registry.pipelines.end())
+            return 0;
+
+        RegisteredPipeline& entry = *it->second;
+
+        if (!entry.compile)
+            return entry.pipeline;
+
+        if (entry.compile->state != AssetState_Ready)
+            return 0;
+
+        if (entry.compile->drawableFrame == ~0u)
+            entry.compile->drawableFrame = frameIndex;
+
+        return entry.pipeline;
+    }
+
+    // the loader that compiles the pipelines must be destroyed first
+    void DestroyPipelineRegistry(PipelineRegistry& registry)
+    {
+        for (auto& entry : registry.pipelines)
+            vkDestroyPipeline(device, entry.second->pipeline, 0);
+
+        registry.pipelines.clear();
+    }
+
+    struct MeshPushConstants
+    {
+        glm::vec4 data;
+        glm::mat4 transformationMatrix;
+        // camera position for meshlet cone culling and lod selection, in mesh space for meshlets and world space for objects
+        // w is the lod scale, the frustum planes come from transformationMatrix
+        glm::vec4 cameraPosition;
+        // number of meshlets or objects tested by the culling shaders
+        uint32_t cullCount;
+        // 1 for the early and 2 for the late pass of occlusion culling
+        uint32_t cullPhase;
+        // size of the depth buffer behind the depth pyramid
+        uint32_t depthWidth;
+        uint32_t depthHeight;
+    };
+
+    enum MemoryUsage
+    {
+        // only accessed by the gpu
+        MemoryUsage_GpuOnly,
+        // written once by the cpu and copied from, kept out of the device local host visible (ReBAR) heap
+        MemoryUsage_Upload,
+        // written by the cpu and read by the gpu directly, device local host visible memory when the device has it
+        MemoryUsage_Dynamic,
+    };
+
+    // picks the type with all required flags and the fewest unwanted ones, larger heaps break ties
+    uint32_t SelectMemoryType(const VkPhysicalDeviceMemoryProperties& memProps, uint32_t memoryTypeBits, MemoryUsage usage)
+    {
+        VkMemoryPropertyFlags required = usage == MemoryUsage_GpuOnly ? VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT : VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        VkMemoryPropertyFlags preferred = usage == MemoryUsage_Upload ? 0 : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        VkMemoryPropertyFlags unwanted = usage == MemoryUsage_GpuOnly ? VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT : usage == MemoryUsage_Upload ? VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT : 0;
+
+        // never useful for the resources of this renderer
+        unwanted |= VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT | VK_MEMORY_PROPERTY_PROTECTED_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+
+        uint32_t result = ~0u;
+        int resultScore = 0;
+
+        for (uint32_t i = 0; i < memProps.memoryTypeCount; ++i)
+        {
+            VkMemoryPropertyFlags flags = memProps.memoryTypes[i].propertyFlags;
+
+            if ((memoryTypeBits & (1 << i)) == 0 || (flags & required) != required)
+                continue;
+
+            int score = (flags & preferred) == preferred ? 1 : 0;
+
+            for (VkMemoryPropertyFlags bits = flags & unwanted; bits; bits &= bits - 1)
+                score -= 2;
+
+            if (result == ~0u || score > resultScore ||
+                (score == resultScore && memProps.memoryHeaps[memProps.memoryTypes[i].heapIndex].size > memProps.memoryHeaps[memProps.memoryTypes[result].heapIndex].size))
+            {
+                result = i;
+                resultScore = score;
+            }
+        }
+
+        if (result == ~0u)
+            throw std::runtime_error("No compatible memory type found");
+
+        return result;
+    }
+
+    // smallest range handed out by a block, also the granularity that keeps buffers and images apart
+    static const VkDeviceSize kMinAllocationSize = 256;
+    static const VkDeviceSize kMemoryBlockSize = 64 * 1024 * 1024;
+
+    // a VkDeviceMemory split with a buddy allocator, every range of order k starts at a multiple of its size which satisfies any power of two alignment up to it
+    struct MemoryBlock
+    {
+        VkDeviceMemory memory; // null once the block was released, the slot is kept so the block indices of live allocations stay valid
+        VkDeviceSize size;
+        uint32_t memoryTypeIndex;
+        uint32_t order; // size is kMinAllocationSize << order
+        bool optimal;   // holds optimal tiling images, only set when bufferImageGranularity forces them apart from buffers
+        void* data;
+        uint32_t allocationCount;
+
+        // offsets of the free ranges of every order
+        std::vector<std::vector<VkDeviceSize>> freeLists;
+    };
+
+    struct MemoryAllocator
+    {
+        std::vector<MemoryBlock> blocks;
+
+        VkDeviceSize bufferImageGranularity;
+        uint32_t maxAllocationCount;
+
+        // live vkAllocateMemory calls, blocks and dedicated allocations
+        uint32_t deviceAllocationCount;
+        uint32_t dedicatedCount;
+        VkDeviceSize dedicatedBytes;
+
+        uint32_t allocationCount;
+        VkDeviceSize usedBytes;
+        VkDeviceSize paddingBytes;
+    };
+
+    struct MemoryStats
+    {
+        uint32_t blockCount;
+        uint32_t dedicatedCount;
+        uint32_t allocationCount;
+        uint32_t deviceAllocationCount;
+        VkDeviceSize reservedBytes; // device memory owned by blocks and dedicated allocations
+        VkDeviceSize usedBytes;     // bytes requested by live resources
+        VkDeviceSize paddingBytes;  // rounding of block ranges to powers of two
+        VkDeviceSize freeBytes;     // unused block memory
+        float fragmentation;        // 1 - largest free range / free bytes, 0 when all free memory is contiguous
+    };
+
+    void InitMemoryAllocator()
+    {
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(physicalDevice, &props);
+
+        memoryAllocator = MemoryAllocator();
+        memoryAllocator.bufferImageGranularity = props.limits.bufferImageGranularity;
+        memoryAllocator.maxAllocationCount = props.limits.maxMemoryAllocationCount;
+    }
+
+    void DestroyMemoryAllocator()
+    {
+        for (MemoryBlock& block : memoryAllocator.blocks)
+        {
+            if (!block.memory)
+                continue;
+
+            if (block.allocationCount != 0)
+                printf("Memory block %p destroyed with %u live allocations\n", (void*)block.memory, block.allocationCount);
+
+            vkFreeMemory(device, block.memory, 0);
+        }
+
+        memoryAllocator.blocks.clear();
+    }
+
+    VkDeviceMemory AllocateDeviceMemory(VkDeviceSize size, uint32_t memoryTypeIndex, const void* next)
+    {
+        if (memoryAllocator.deviceAllocationCount >= memoryAllocator.maxAllocationCount)
+            throw std::runtime_error("Device memory allocation count exceeds maxMemoryAllocationCount");
+
+        VkMemoryAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+        allocateInfo.pNext = next;
+        allocateInfo.allocationSize = size;
+        allocateInfo.memoryTypeIndex = memoryTypeIndex;
+
+        VkDeviceMemory memory = 0;
+        VK_CHECK(vkAllocateMemory(device, &allocateInfo, 0, &memory));
+
+        memoryAllocator.deviceAllocationCount++;
+
+        return memory;
+    }
+
+    void* MapDeviceMemory(const VkPhysicalDeviceMemoryProperties& memProps, VkDeviceMemory memory, uint32_t memoryTypeIndex)
+    {
+        if ((memProps.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == 0)
+            return 0;
+
+        void* data = 0;
+        VK_CHECK(vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &data));
+
+        return data;
+    }
+
+    // blocks take at most an eighth of their heap so small heaps such as the ReBAR window aren't exhausted by a single block
+    VkDeviceSize MemoryBlockSize(const VkPhysicalDeviceMemoryProperties& memProps, uint32_t memoryTypeIndex)
+    {
+        VkDeviceSize heapSize = memProps.memoryHeaps[memProps.memoryTypes[memoryTypeIndex].heapIndex].size;
+        VkDeviceSize size = kMemoryBlockSize;
+
+        while (size > kMinAllocationSize * 1024 && size > heapSize / 8)
+            size /= 2;
+
+        return size;
+    }
+
+    // takes the smallest free range of the block that fits the requested order and splits it down to that order, false when none is free
+    bool AllocateFromBlock(MemoryBlock& block, uint32_t order, VkDeviceSize& offset)
+    {
+        uint32_t freeOrder = order;
+        while (freeOrder <= block.order && block.freeLists[freeOrder].empty())
+            freeOrder++;
+
+        if (freeOrder > block.order)
+            return false;
+
+        offset = block.freeLists[freeOrder].back();
+        block.freeLists[freeOrder].pop_back();
+
+        // the upper halves of the split ranges become free buddies
+        while (freeOrder > order)
+        {
+            freeOrder--;
+            block.freeLists[freeOrder].push_back(offset + (kMinAllocationSize << freeOrder));
+        }
+
+        block.allocationCount++;
+        return true;
+    }
+
+    void FreeToBlock(MemoryBlock& block, VkDeviceSize offset, uint32_t order)
+    {
+        // merge with the buddy for as long as it is free
+        while (order < block.order)
+        {
+            VkDeviceSize buddy = offset ^ (kMinAllocationSize << order);
+            std::vector<VkDeviceSize>& freeList = block.freeLists[order];
+
+            auto it = std::find(freeList.begin(), freeList.end(), buddy);
+            if (it == freeList.end())
+                break;
+
+            *it = freeList.back();
+            freeList.pop_back();
+
+            offset = std::min(offset, buddy);
+            order++;
+        }
+
+        block.freeLists[order].push_back(offset);
+        block.allocationCount--;
+    }
+
+    // optimal images are resources the driver may lay out differently from buffers, they are never placed in the same bufferImageGranularity page as one
+    void AllocateMemory(Allocation& result, const VkPhysicalDeviceMemoryProperties& memProps, const VkMemoryRequirements2& requirements2, const VkMemoryDedicatedRequirements& dedicated,
+        MemoryUsage usage, bool optimal, VkBuffer dedicatedBuffer, VkImage dedicatedImage)
+    {
+        const VkMemoryRequirements& requirements = requirements2.memoryRequirements;
+
+        uint32_t memoryTypeIndex = SelectMemoryType(memProps, requirements.memoryTypeBits, usage);
+        VkDeviceSize blockSize = MemoryBlockSize(memProps, memoryTypeIndex);
+
+        result = Allocation();
+        result.size = requirements.size;
+
+        // large resources would leave most of a block unused, drivers that ask for a dedicated allocation get one
+        if (dedicated.prefersDedicatedAllocation || dedicated.requiresDedicatedAllocation || requirements.size > blockSize / 2)
+        {
+            VkMemoryDedicatedAllocateInfo dedicatedInfo = { VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO };
+            dedicatedInfo.buffer = dedicatedBuffer;
+            dedicatedInfo.image = dedicatedImage;
+
+            result.memory = AllocateDeviceMemory(requirements.size, memoryTypeIndex, &dedicatedInfo);
+            result.data = MapDeviceMemory(memProps, result.memory, memoryTypeIndex);
+            result.block = ~0u;
+
+            memoryAllocator.dedicatedCount++;
+            memoryAllocator.dedicatedBytes += requirements.size;
+            return;
+        }
+
+        // ranges of kMinAllocationSize never share a page when the granularity is at most that, so the resource kinds only need separate blocks above it
+        bool separateOptimal = optimal && memoryAllocator.bufferImageGranularity > kMinAllocationSize;
+
+        uint32_t order = 0;
+        while ((kMinAllocationSize << order) < std::max(requirements.size, requirements.alignment))
+            order++;
+
+        VkDeviceSize offset = 0;
+        uint32_t blockIndex = ~0u;
+
+        // the first live block of the memory type and resource kind with a large enough free range
+        for (uint32_t i = 0; i < uint32_t(memoryAllocator.blocks.size()); ++i)
+        {
+            MemoryBlock& block = memoryAllocator.blocks[i];
+
+            if (block.memory && block.memoryTypeIndex == memoryTypeIndex && block.optimal == separateOptimal && AllocateFromBlock(block, order, offset))
+            {
+                blockIndex = i;
+                break;
+            }
+        }
+
+        if (blockIndex == ~0u)
+        {
+            MemoryBlock block = {};
+            block.size = blockSize;
+            block.memoryTypeIndex = memoryTypeIndex;
+            block.optimal = separateOptimal;
+
+            while ((kMinAllocationSize << block.order) < blockSize)
+                block.order++;
+
+            block.memory = AllocateDeviceMemory(blockSize, memoryTypeIndex, 0);
+            block.data = MapDeviceMemory(memProps, block.memory, memoryTypeIndex);
+            block.freeLists.resize(block.order + 1);
+            block.freeLists[block.order].push_back(0);
+
+            AllocateFromBlock(block, order, offset);
+
+            // reuse the slot of a released block if there is one
+            blockIndex = 0;
+            while (blockIndex < memoryAllocator.blocks.size() && memoryAllocator.blocks[blockIndex].memory)
+                blockIndex++;
+
+            if (blockIndex < memoryAllocator.blocks.size())
+                memoryAllocator.blocks[blockIndex] = std::move(block);
+            else
+                memoryAllocator.blocks.push_back(std::move(block));
+        }
+
+        const MemoryBlock& block = memoryAllocator.blocks[blockIndex];
+
+        result.memory = block.memory;
+        result.offset = offset;
+        result.data = block.data ? static_cast<char*>(block.data) + offset : 0;
+        result.block = blockIndex;
+        result.order = order;
+
+        memoryAllocator.allocationCount++;
+        memoryAllocator.usedBytes += requirements.size;
+        memoryAllocator.paddingBytes += (kMinAllocationSize << order) - requirements.size;
+    }
+
+    // the first block of every memory type and resource kind stays around for later allocations when it empties, other empty blocks are released
+    void FreeMemory(const Allocation& allocation)
+    {
+        if (allocation.memory == VK_NULL_HANDLE)
+            return;
+
+        if (allocation.block == ~0u)
+        {
+            vkFreeMemory(device, allocation.memory, 0);
+
+            memoryAllocator.deviceAllocationCount--;
+            memoryAllocator.dedicatedCount--;
+            memoryAllocator.dedicatedBytes -= allocation.size;
+            return;
+        }
+
+        MemoryBlock& block = memoryAllocator.blocks[allocation.block];
+
+        FreeToBlock(block, allocation.offset, allocation.order);
+
+        memoryAllocator.allocationCount--;
+        memoryAllocator.usedBytes -= allocation.size;
+        memoryAllocator.paddingBytes -= (kMinAllocationSize << allocation.order) - allocation.size;
+
+        if (block.allocationCount == 0 && !IsFirstBlock(allocation.block))
+        {
+            // unmapped implicitly by vkFreeMemory
+            vkFreeMemory(device, block.memory, 0);
+
+            block.memory = VK_NULL_HANDLE;
+            block.data = 0;
+            block.freeLists.clear();
+
+            memoryAllocator.deviceAllocationCount--;
+        }
+    }
+
+    // whether no live block of the same memory type and resource kind comes before this one
+    bool IsFirstBlock(uint32_t blockIndex)
+    {
+        const MemoryBlock& block = memoryAllocator.blocks[blockIndex];
+
+        for (uint32_t i = 0; i < blockIndex; ++i)
+        {
+            const MemoryBlock& other = memoryAllocator.blocks[i];
+
+            if (other.memory && other.memoryTypeIndex == block.memoryTypeIndex && other.optimal == block.optimal)
+                return false;
+        }
+
+        return true;
+    }
+
+    MemoryStats GetMemoryStats()
+    {
+        MemoryStats stats = {};
+        stats.dedicatedCount = memoryAllocator.dedicatedCount;
+        stats.allocationCount = memoryAllocator.allocationCount + memoryAllocator.dedicatedCount;
+        stats.deviceAllocationCount = memoryAllocator.deviceAllocationCount;
+        stats.reservedBytes = memoryAllocator.dedicatedBytes;
+        stats.usedBytes = memoryAllocator.usedBytes + memoryAllocator.dedicatedBytes;
+        stats.paddingBytes = memoryAllocator.paddingBytes;
+
+        VkDeviceSize largestFree = 0;
+
+        for (const MemoryBlock& block : memoryAllocator.blocks)
+        {
+            if (!block.memory)
+                continue;
+
+            stats.blockCount++;
+            stats.reservedBytes += block.size;
+
+            for (uint32_t order = 0; order <= block.order; ++order)
+            {
+                VkDeviceSize rangeSize = kMinAllocationSize << order;
+
+                stats.freeBytes += rangeSize * block.freeLists[order].size();
+
+                if (!block.freeLists[order].empty())
+                    largestFree = std::max(largestFree, rangeSize);
+            }
+        }
+
+        stats.fragmentation = stats.freeBytes ? 1.0f - float(double(largestFree) / double(stats.freeBytes)) : 0.0f;
+
+        return stats;
+    }
+
+    void PrintMemoryStats(const char* stage)
+    {
+        MemoryStats stats = GetMemoryStats();
+
+        printf("Device memory %s: %u allocations in %u blocks and %u dedicated, %u of %u vkAllocateMemory, %.1f MB reserved, %.1f MB used, %.1f MB padding, %.1f MB free, fragmentation %.1f%%\n",
+            stage, stats.allocationCount, stats.blockCount, stats.dedicatedCount, stats.deviceAllocationCount, memoryAllocator.maxAllocationCount,
+            double(stats.reservedBytes) / (1024 * 1024), double(stats.usedBytes) / (1024 * 1024), double(stats.paddingBytes) / (1024 * 1024),
+            double(stats.freeBytes) / (1024 * 1024), stats.fragmentation * 100.0f);
+    }
+
+    void AllocateBufferMemory(Allocation& result, const VkPhysicalDeviceMemoryProperties& memProps, VkBuffer buffer, MemoryUsage usage)
+    {
+        VkBufferMemoryRequirementsInfo2 requirementsInfo = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2 };
+        requirementsInfo.buffer = buffer;
+
+        VkMemoryDedicatedRequirements dedicated = { VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS };
+        VkMemoryRequirements2 requirements = { VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2 };
+        requirements.pNext = &dedicated;
+
+        vkGetBufferMemoryRequirements2(device, &requirementsInfo, &requirements);
+
+        AllocateMemory(result, memProps, requirements, dedicated, usage, false, buffer, VK_NULL_HANDLE);
+
+        VK_CHECK(vkBindBufferMemory(device, buffer, result.memory, result.offset));
+    }
+
+    void AllocateImageMemory(Allocation& result, const VkPhysicalDeviceMemoryProperties& memProps, VkImage image, bool optimal)
+    {
+        VkImageMemoryRequirementsInfo2 requirementsInfo = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2 };
+        requirementsInfo.image = image;
+
+        VkMemoryDedicatedRequirements dedicated = { VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS };
+        VkMemoryRequirements2 requirements = { VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2 };
+        requirements.pNext = &dedicated;
+
+        vkGetImageMemoryRequirements2(device, &requirementsInfo, &requirements);
+
+        AllocateMemory(result, memProps, requirements, dedicated, MemoryUsage_GpuOnly, optimal, VK_NULL_HANDLE, image);
+
+        VK_CHECK(vkBindImageMemory(device, image, result.memory, result.offset));
+    }
+
+    // host visible buffer with a persistent mapping in data, staging buffers use MemoryUsage_Upload
+    void CreateBuffer(Buffer& result, const VkPhysicalDeviceMemoryProperties& memProps, size_t size, VkBufferUsageFlags usage, MemoryUsage memoryUsage = MemoryUsage_Upload)
+    {
+
+        VkBufferCreateInfo createInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+        createInfo.size = size;
+        createInfo.usage = usage;
+        
+        VkBuffer buffer = 0;
+        VK_CHECK(vkCreateBuffer(device, &createInfo, 0, &buffer));
+
+        AllocateBufferMemory(result.allocation, memProps, buffer, memoryUsage);
+
+        result.buffer = buffer;
+        result.data = result.allocation.data;
+        result.size = size;
+    }
+
+    // device local buffer without a mapping, filled by transfers or shaders
+    void CreateDeviceBuffer(Buffer& result, const VkPhysicalDeviceMemoryProperties& memProps, size_t size, VkBufferUsageFlags usage)
+    {
+        VkBufferCreateInfo createInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+        createInfo.size = size;
+        createInfo.usage = usage;
+
+        VkBuffer buffer = 0;
+        VK_CHECK(vkCreateBuffer(device, &createInfo, 0, &buffer));
+
+        AllocateBufferMemory(result.allocation, memProps, buffer, MemoryUsage_GpuOnly);
+
+        result.buffer = buffer;
+        result.data = 0;
+        result.size = size;
+    }
+
+    struct MipmapImage
+    {
+        VkImage image;
+        uint32_t width;
+        uint32_t height;
+        uint32_t mipLevels;
+    };
+
+    // one submission of the upload context, batches are recycled once their fence signals
+    struct UploadBatch
+    {
+        VkCommandPool commandPool;
+        VkCommandBuffer commandBuffer;
+        // graphics queue side of the queue family ownership transfer, only used with a separate transfer queue
+        VkCommandPool acquireCommandPool;
+        VkCommandBuffer acquireCommandBuffer;
+        VkSemaphore semaphore;
+        VkFence fence;
+        bool pending;
+
+        // staging ring range read by the batch
+        size_t stagingBegin;
+        size_t stagingEnd;
+
+        // ownership transfers recorded at submit, the release on the transfer queue and the matching acquire on the graphics queue
+        std::vector<VkBufferMemoryBarrier> bufferBarriers;
+        std::vector<VkImageMemoryBarrier> imageBarriers;
+
+        // images whose mip chain is blitted on the graphics queue once level 0 has arrived
+        std::vector<MipmapImage> mipmapImages;
+    };
+
+    static const uint32_t kUploadBatchCount = 2;
+
+    // records buffer and image uploads into batches that are submitted on the transfer queue when the device has a dedicated one
+    struct UploadContext
+    {
+        VkQueue queue;
+        VkQueue graphicsQueue;
+        uint32_t queueFamilyIndex;
+        VkPhysicalDeviceMemoryProperties memoryProperties;
+
+        UploadBatch batches[kUploadBatchCount];
+        uint32_t batchIndex;
+        bool recording;
+
+        // staging ring, every batch owns a contiguous range of it until its fence signals
+        Buffer staging;
+        size_t head;
+
+        // totals for the load log
+        uint32_t copyCount;
+        uint32_t submitCount;
+        size_t uploadedBytes;
+    };
+
+    // image copies need offsets aligned to the texel size, 16 covers every uncompressed and block compressed format
+    static const size_t kStagingAlignment = 16;
+    // assets are uploaded as they finish loading, larger images grow the ring
+    static const size_t kStagingSize = 16 * 1024 * 1024;
+
+    bool SeparateTransferQueue(const UploadContext& context)
+    {
+        return context.queueFamilyIndex != queueFamilyIndex;
+    }
+
+    void CreateUploadContext(UploadContext& result, const VkPhysicalDeviceMemoryProperties& memProps, size_t stagingSize)
+    {
+        result = UploadContext();
+        result.queueFamilyIndex = transferQueueFamilyIndex;
+        result.memoryProperties = memProps;
+
+        vkGetDeviceQueue(device, transferQueueFamilyIndex, 0, &result.queue);
+        vkGetDeviceQueue(device, queueFamilyIndex, 0, &result.graphicsQueue);
+
+        for (UploadBatch& batch : result.batches)
+        {
+            batch.commandPool = CreateCommandPool(VK_COMMAND_POOL_CREATE_TRANSIENT_BIT, transferQueueFamilyIndex);
+            batch.commandBuffer = AllocateCommandBuffer(batch.commandPool);
+
+            if (SeparateTransferQueue(result))
+            {
+                batch.acquireCommandPool = CreateCommandPool(VK_COMMAND_POOL_CREATE_TRANSIENT_BIT, queueFamilyIndex);
+                batch.acquireCommandBuffer = AllocateCommandBuffer(batch.acquireCommandPool);
+                batch.semaphore = CreateVulkanSemaphore();
+            }
+
+            batch.fence = CreateFence(0);
+        }
+
+        CreateBuffer(result.staging, memProps, stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    }
+
+    void DestroyUploadContext(UploadContext& context)
+    {
+        FlushUploads(context);
+        WaitUploads(context);
+
+        for (UploadBatch& batch : context.batches)
+        {
+            vkDestroyCommandPool(device, batch.commandPool, 0);
+            vkDestroyCommandPool(device, batch.acquireCommandPool, 0);
+            vkDestroySemaphore(device, batch.semaphore, 0);
+            vkDestroyFence(device, batch.fence, 0);
+        }
+
+        DestroyBuffer(context.staging);
+    }
+
+    void RetireUploadBatch(UploadBatch& batch)
+    {
+        if (!batch.pending)
+            return;
+
+        VK_CHECK(vkWaitForFences(device, 1, &batch.fence, VK_TRUE, ~0ull));
+        VK_CHECK(vkResetFences(device, 1, &batch.fence));
+
+        VK_CHECK(vkResetCommandPool(device, batch.commandPool, 0));
+
+        if (batch.acquireCommandPool)
+            VK_CHECK(vkResetCommandPool(device, batch.acquireCommandPool, 0));
+
+        batch.pending = false;
+    }
+
+    // blocks until every submitted batch has completed
+    void WaitUploads(UploadContext& context)
+    {
+        for (UploadBatch& batch : context.batches)
+            RetireUploadBatch(batch);
+    }
+
+    VkCommandBuffer BeginUploads(UploadContext& context)
+    {
+        UploadBatch& batch = context.batches[context.batchIndex];
+
+        if (!context.recording)
+        {
+            // the batch slot may still be in flight from kUploadBatchCount submits ago
+            RetireUploadBatch(batch);
+
+            batch.stagingBegin = context.head;
+
+            VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+            VK_CHECK(vkBeginCommandBuffer(batch.commandBuffer, &beginInfo));
+
+            context.recording = true;
+        }
+
+        return batch.commandBuffer;
+    }
+
+    // submits everything recorded so far without waiting, later graphics submissions are ordered after the uploads by the barriers in the batch
+    void FlushUploads(UploadContext& context)
+    {
+        TRACE_ZONE("FlushUploads");
+
+        if (!context.recording)
+            return;
+
+        UploadBatch& batch = context.batches[context.batchIndex];
+        batch.stagingEnd = context.head;
+
+        if (SeparateTransferQueue(context))
+        {
+            // the release half of the ownership transfer, src access is made available before the queue family changes
+            for (VkBufferMemoryBarrier& barrier : batch.bufferBarriers)
+                barrier.dstAccessMask = 0;
+
+            for (VkImageMemoryBarrier& barrier : batch.imageBarriers)
+                barrier.dstAccessMask = 0;
+
+            vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, 0,
+                uint32_t(batch.bufferBarriers.size()), batch.bufferBarriers.data(), uint32_t(batch.imageBarriers.size()), batch.imageBarriers.data());
+
+            VK_CHECK(vkEndCommandBuffer(batch.commandBuffer));
+
+            VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+            submitInfo.commandBufferCount = 1;
+            submitInfo.pCommandBuffers = &batch.commandBuffer;
+            submitInfo.signalSemaphoreCount = 1;
+            submitInfo.pSignalSemaphores = &batch.semaphore;
+
+            VK_CHECK(vkQueueSubmit(context.queue, 1, &submitInfo, 0));
+
+            // the acquire half repeats the barriers with the destination access on the graphics queue
+            VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+            VK_CHECK(vkBeginCommandBuffer(batch.acquireCommandBuffer, &beginInfo));
+
+            for (VkBufferMemoryBarrier& barrier : batch.bufferBarriers)
+            {
+                barrier.srcAccessMask = 0;
+                barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+            }
+
+            // images that still get their mip chain stay in transfer dst layout for the blits
+            for (VkImageMemoryBarrier& barrier : batch.imageBarriers)
+            {
+                barrier.srcAccessMask = 0;
+                barrier.dstAccessMask = barrier.newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL ? VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_SHADER_READ_BIT;
+            }
+
+            vkCmdPipelineBarrier(batch.acquireCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, 0,
+                uint32_t(batch.bufferBarriers.size()), batch.bufferBarriers.data(), uint32_t(batch.imageBarriers.size()), batch.imageBarriers.data());
+
+            // blits need a graphics queue
+            for (const MipmapImage& image : batch.mipmapImages)
+                GenerateMipmaps(batch.acquireCommandBuffer, image);
+
+            VK_CHECK(vkEndCommandBuffer(batch.acquireCommandBuffer));
+
+            VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+            VkSubmitInfo acquireInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+            acquireInfo.waitSemaphoreCount = 1;
+            acquireInfo.pWaitSemaphores = &batch.semaphore;
+            acquireInfo.pWaitDstStageMask = &waitStage;
+            acquireInfo.commandBufferCount = 1;
+            acquireInfo.pCommandBuffers = &batch.acquireCommandBuffer;
+
+            VK_CHECK(vkQueueSubmit(context.graphicsQueue, 1, &acquireInfo, batch.fence));
+        }
+        else
+        {
+            // one barrier makes all buffer copies of the batch visible to whatever reads them later
+            VkMemoryBarrier uploadBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+            uploadBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            uploadBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+
+            vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &uploadBarrier, 0, 0,
+                uint32_t(batch.imageBarriers.size()), batch.imageBarriers.data());
+
+            for (const MipmapImage& image : batch.mipmapImages)
+                GenerateMipmaps(batch.commandBuffer, image);
+
+            VK_CHECK(vkEndCommandBuffer(batch.commandBuffer));
+
+            VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+            submitInfo.commandBufferCount = 1;
+            submitInfo.pCommandBuffers = &batch.commandBuffer;
+
+            VK_CHECK(vkQueueSubmit(context.queue, 1, &submitInfo, batch.fence));
+        }
+
+        batch.bufferBarriers.clear();
+        batch.imageBarriers.clear();
+        batch.mipmapImages.clear();
+        batch.pending = true;
+
+        context.recording = false;
+        context.batchIndex = (context.batchIndex + 1) % kUploadBatchCount;
+        context.submitCount++;
+    }
+
+    // reserves size bytes of the staging ring, waiting for the batches whose data is still in the way
+    size_t AllocateStaging(UploadContext& context, size_t size)
+    {
+        size_t offset = (context.head + kStagingAlignment - 1) & ~(kStagingAlignment - 1);
+
+        // every batch owns one contiguous range, so the current one is submitted before the ring wraps
+        if (offset + size > context.staging.size)
+        {
+            FlushUploads(context);
+
+            context.head = 0;
+            offset = 0;
+        }
+
+        // only images that don't fit in an empty ring get here, the ring grows to hold them
+        if (size > context.staging.size)
+        {
+            WaitUploads(context);
+
+            DestroyBuffer(context.staging);
+            CreateBuffer(context.staging, context.memoryProperties, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+        }
+
+        for (UploadBatch& batch : context.batches)
+            if (batch.pending && offset < batch.stagingEnd && batch.stagingBegin < offset + size)
+                RetireUploadBatch(batch);
+
+        BeginUploads(context);
+
+        context.head = offset + size;
+        return offset;
+    }
+
+    // buffers larger than the staging ring are copied in ring sized pieces, ownership moves to the graphics queue with the last one
+    void UploadBuffer(UploadContext& context, const Buffer& buffer, const void* data, size_t size, size_t bufferOffset = 0)
+    {
+        for (size_t copied = 0; copied < size; )
+        {
+            size_t chunk = std::min(size - copied, context.staging.size);
+            size_t offset = AllocateStaging(context, chunk);
+
+            memcpy(static_cast<char*>(context.staging.data) + offset, static_cast<const char*>(data) + copied, chunk);
+
+            VkBufferCopy region = {};
+            region.srcOffset = offset;
+            region.dstOffset = bufferOffset + copied;
+            region.size = chunk;
+
+            vkCmdCopyBuffer(BeginUploads(context), context.staging.buffer, buffer.buffer, 1, &region);
+
+            copied += chunk;
+            context.copyCount++;
+        }
+
+        if (SeparateTransferQueue(context))
+        {
+            VkBufferMemoryBarrier barrier = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.srcQueueFamilyIndex = context.queueFamilyIndex;
+            barrier.dstQueueFamilyIndex = queueFamilyIndex;
+            barrier.buffer = buffer.buffer;
+            barrier.offset = bufferOffset;
+            barrier.size = size;
+
+            context.batches[context.batchIndex].bufferBarriers.push_back(barrier);
+        }
+
+        context.uploadedBytes += size;
+    }
+
+    // creates a device local buffer and records the upload of its contents
+    void CreateUploadedBuffer(UploadContext& context, Buffer& result, const VkPhysicalDeviceMemoryProperties& memProps, const void* data, size_t size, VkBufferUsageFlags usage)
+    {
+        CreateDeviceBuffer(result, memProps, size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+        UploadBuffer(context, result, data, size);
+    }
+
+    uint32_t MipLevelCount(uint32_t width, uint32_t height)
+    {
+        uint32_t result = 1;
+
+        while ((width | height) >> result)
+            result++;
+
+        return result;
+    }
+
+    // blitting needs linear filtering of the format, the format as a transfer source and a graphics queue
+    bool SupportsLinearBlit(VkFormat format)
+    {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+
+        VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT | VK_FORMAT_FEATURE_TRANSFER_SRC_BIT;
+
+        return (props.optimalTilingFeatures & required) == required;
+    }
+
+    // usage of an image filled by UploadImage, only images whose mip chain is blitted are read by transfers
+    VkImageUsageFlags UploadedImageUsage(VkFormat format, uint32_t levelCount, uint32_t mipLevels)
+    {
+        VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
+        if (levelCount < mipLevels && SupportsLinearBlit(format))
+            usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+        return usage;
+    }
+
+    // every level is blitted from the previous one, expects all levels in transfer dst layout and leaves them shader read only
+    void GenerateMipmaps(VkCommandBuffer commandBuffer, const MipmapImage& image)
+    {
+        int32_t width = int32_t(image.width);
+        int32_t height = int32_t(image.height);
+
+        for (uint32_t level = 1; level < image.mipLevels; ++level)
+        {
+            VkImageMemoryBarrier srcBarrier = ImageBarrier(image.image, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+            srcBarrier.subresourceRange.baseMipLevel = level - 1;
+            srcBarrier.subresourceRange.levelCount = 1;
+
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, 0, 0, 0, 1, &srcBarrier);
+
+            int32_t levelWidth = std::max(width >> 1, 1);
+            int32_t levelHeight = std::max(height >> 1, 1);
+
+            VkImageBlit region = {};
+            region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.srcSubresource.mipLevel = level - 1;
+            region.srcSubresource.layerCount = 1;
+            region.srcOffsets[1] = { width, height, 1 };
+            region.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.dstSubresource.mipLevel = level;
+            region.dstSubresource.layerCount = 1;
+            region.dstOffsets[1] = { levelWidth, levelHeight, 1 };
+
+            vkCmdBlitImage(commandBuffer, image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, VK_FILTER_LINEAR);
+
+            width = levelWidth;
+            height = levelHeight;
+        }
+
+        // all levels but the last were blit sources
+        VkImageMemoryBarrier readBarriers[2];
+
+        readBarriers[0] = ImageBarrier(image.image, VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        readBarriers[0].subresourceRange.levelCount = image.mipLevels - 1;
+
+        readBarriers[1] = ImageBarrier(image.image, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        readBarriers[1].subresourceRange.baseMipLevel = image.mipLevels - 1;
+        readBarriers[1].subresourceRange.levelCount = 1;
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, 0, 0, 0, 2, readBarriers);
+    }
+
+    static float srgbToLinear(float value)
+    {
+        return value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+    }
+
+    static float linearToSrgb(float value)
+    {
+        return value <= 0.0031308f ? value * 12.92f : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+    }
+
+    // 2x2 box filter of an rgba8 level, odd edges repeat their last texel
+    // srgb color channels are averaged in linear space like a blit would, alpha is always linear
+    void DownsampleRgba8(uint8_t* dst, const uint8_t* src, uint32_t width, uint32_t height, bool srgb)
+    {
+        uint32_t dstWidth = std::max(width >> 1, 1u);
+        uint32_t dstHeight = std::max(height >> 1, 1u);
+
+        float linear[256];
+
+        for (uint32_t i = 0; i < 256; ++i)
+            linear[i] = srgbToLinear(float(i) / 255.0f);
+
+        for (uint32_t y = 0; y < dstHeight; ++y)
+        {
+            uint32_t y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+
+            for (uint32_t x = 0; x < dstWidth; ++x)
+            {
+                uint32_t x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+
+                for (uint32_t c = 0; c < 4; ++c)
+                {
+                    uint8_t s00 = src[(y0 * width + x0) * 4 + c], s01 = src[(y0 * width + x1) * 4 + c];
+                    uint8_t s10 = src[(y1 * width + x0) * 4 + c], s11 = src[(y1 * width + x1) * 4 + c];
+
+                    if (srgb && c < 3)
+                    {
+                        float average = (linear[s00] + linear[s01] + linear[s10] + linear[s11]) * 0.25f;
+                        dst[(y * dstWidth + x) * 4 + c] = uint8_t(linearToSrgb(average) * 255.0f + 0.5f);
+                    }
+                    else
+                    {
+                        dst[(y * dstWidth + x) * 4 + c] = uint8_t((s00 + s01 + s10 + s11 + 2) / 4);
+                    }
+                }
+            }
+        }
+    }
+
+    // records the copy of the given levels of a 2d image, when there are fewer than mipLevels the chain is completed from level 0
+    // with blits on the gpu or, for rgba8 images that can't be blitted, by downsampling into the staging ring
+    void UploadImage(UploadContext& context, const Image& image, VkFormat format, const TextureLevel* levels, uint32_t levelCount, uint32_t width, uint32_t height, uint32_t mipLevels)
+    {
+        bool blitMipmaps = levelCount < mipLevels && SupportsLinearBlit(format);
+        bool cpuMipmaps = levelCount < mipLevels && !blitMipmaps;
+
+        if (levelCount < mipLevels && (levelCount != 1 || (cpuMipmaps && !IsUncompressedFormat(format))))
+            throw std::runtime_error("Mipmaps of this texture format can't be generated");
+
+        uint32_t copyLevels = cpuMipmaps ? mipLevels : levelCount;
+
+        // every level is staged at a 16 byte aligned offset
+        size_t stagingSize = 0;
+
+        for (uint32_t level = 0; level < copyLevels; ++level)
+        {
+            size_t levelSize = level < levelCount ? levels[level].size : size_t(std::max(width >> level, 1u)) * std::max(height >> level, 1u) * 4;
+            stagingSize += (levelSize + kStagingAlignment - 1) & ~(kStagingAlignment - 1);
+        }
+
+        size_t offset = AllocateStaging(context, stagingSize);
+        uint8_t* staging = static_cast<uint8_t*>(context.staging.data) + offset;
+
+        std::vector<VkBufferImageCopy> regions(copyLevels);
+        size_t levelOffset = 0;
+
+        for (uint32_t level = 0; level < copyLevels; ++level)
+        {
+            uint32_t levelWidth = std::max(width >> level, 1u);
+            uint32_t levelHeight = std::max(height >> level, 1u);
+            size_t levelSize = size_t(levelWidth) * levelHeight * 4;
+
+            if (level < levelCount)
+            {
+                levelSize = levels[level].size;
+                memcpy(staging + levelOffset, levels[level].data, levelSize);
+
+                context.uploadedBytes += levelSize;
+            }
+            else
+            {
+                DownsampleRgba8(staging + levelOffset, staging + (regions[level - 1].bufferOffset - offset), std::max(width >> (level - 1), 1u), std::max(height >> (level - 1), 1u), format == VK_FORMAT_R8G8B8A8_SRGB);
+            }
+
+            // extents are in texels, compressed levels smaller than a block still cover the whole level
+            VkBufferImageCopy& region = regions[level];
+            region.bufferOffset = offset + levelOffset;
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.mipLevel = level;
+            region.imageSubresource.layerCount = 1;
+            region.imageExtent = { levelWidth, levelHeight, 1 };
+
+            levelOffset += (levelSize + kStagingAlignment - 1) & ~(kStagingAlignment - 1);
+        }
+
+        VkCommandBuffer commandBuffer = BeginUploads(context);
+
+        VkImageMemoryBarrier copyBarrier = ImageBarrier(image.image, 0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, 0, 0, 0, 1, &copyBarrier);
+
+        vkCmdCopyBufferToImage(commandBuffer, context.staging.buffer, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, uint32_t(regions.size()), regions.data());
+
+        UploadBatch& batch = context.batches[context.batchIndex];
+
+        // blitted images stay in transfer dst layout until GenerateMipmaps, a separate transfer queue only hands them over
+        VkImageLayout uploadedLayout = blitMipmaps ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        VkImageMemoryBarrier readBarrier = ImageBarrier(image.image, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, uploadedLayout);
+
+        if (SeparateTransferQueue(context))
+        {
+            readBarrier.srcQueueFamilyIndex = context.queueFamilyIndex;
+            readBarrier.dstQueueFamilyIndex = queueFamilyIndex;
+        }
+
+        if (!blitMipmaps || SeparateTransferQueue(context))
+            batch.imageBarriers.push_back(readBarrier);
+
+        if (blitMipmaps)
+            batch.mipmapImages.push_back({ image.image, width, height, mipLevels });
+
+        context.copyCount++;
+    }
+
+    void DestroyBuffer(const Buffer& buffer)
+    {
+        vkDestroyBuffer(device, buffer.buffer, 0);
+        FreeMemory(buffer.allocation);
+    }
+
+    void DestroyImage(const Image& image)
+    {
+        vkDestroyImage(device, image.image, 0);
+        FreeMemory(image.allocation);
+    }
+
+    void CreateImage(Image& result, const VkPhysicalDeviceMemoryProperties& memProps, VkFormat format, uint32_t width, uint32_t height, VkImageUsageFlags usage, uint32_t mipLevels = 1)
+    {
+        VkImageCreateInfo createInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+        createInfo.imageType = VK_IMAGE_TYPE_2D;
+        createInfo.format = format;
+        createInfo.mipLevels = mipLevels;
+        createInfo.arrayLayers = 1;
+        createInfo.extent.width = width;
+        createInfo.extent.height = height;
+        createInfo.extent.depth = 1;
+        createInfo.usage = usage;
+        createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        createInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+
+        VkImage image = 0;
+        VK_CHECK(vkCreateImage(device, &createInfo, 0, &image));
+
+        AllocateImageMemory(result.allocation, memProps, image, createInfo.tiling == VK_IMAGE_TILING_OPTIMAL);
+   
+        result.image = image;
+    }
+
+    VkSampler CreateTextureSampler()
+    {
+        VkSamplerCreateInfo samplerInfo = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+        samplerInfo.magFilter = VK_FILTER_LINEAR;
+        samplerInfo.minFilter = VK_FILTER_LINEAR;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        samplerInfo.mipLodBias = 0.0f;
+        // 16x is where the quality gain flattens out, devices may support less
+        samplerInfo.anisotropyEnable = options.mips && maxSamplerAnisotropy > 1.0f;
+        samplerInfo.maxAnisotropy = std::min(maxSamplerAnisotropy, 16.0f);
+        samplerInfo.minLod = 0.0f;
+        samplerInfo.maxLod = options.mips ? VK_LOD_CLAMP_NONE : 0.0f;
+        samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+        samplerInfo.unnormalizedCoordinates = VK_FALSE;
+
+        VkSampler sampler = 0;
+        VK_CHECK(vkCreateSampler(device, &samplerInfo, 0, &sampler));
+
+        return sampler;
+    }
+
+    // the depth pyramid is read with texelFetch, the sampler only completes the combined image sampler descriptor
+    VkSampler CreateDepthSampler()
+    {
+        VkSamplerCreateInfo samplerInfo = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+        samplerInfo.magFilter = VK_FILTER_NEAREST;
+        samplerInfo.minFilter = VK_FILTER_NEAREST;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.minLod = 0.0f;
+        samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+        VkSampler sampler = 0;
+        VK_CHECK(vkCreateSampler(device, &samplerInfo, 0, &sampler));
+
+        return sampler;
+    }
+
+    void MainLoop()
+    {
+
+        VkQueue queue = 0;
+        vkGetDeviceQueue(device, queueFamilyIndex, 0, &queue);
+
+        if (options.headless)
+            swapchainFormat = VK_FORMAT_R8G8B8A8_UNORM;
+        else
+        {
+            GetSwapchainFormat();
+            GetPresentMode();
+        }
+
+        int windowWidth = int(options.width);
+        int windowHeight = int(options.height);
+
+        if (!options.headless)
+            glfwGetWindowSize(window, &windowWidth, &windowHeight);
+
+        VkPhysicalDeviceMemoryProperties memoryProperties;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+        InitMemoryAllocator();
+
+        createThreadPool(recordThreadPool, options.recordThreads - 1, "record");
+        
+        if (options.occlusion)
+        {
+            VkFormatProperties depthProperties;
+            vkGetPhysicalDeviceFormatProperties(physicalDevice, VK_FORMAT_D32_SFLOAT, &depthProperties);
+
+            // the culling pass is gpu driven and the pyramid is built by sampling the depth buffer
+            if (!drawIndirectCountSupported || !(depthProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+            {
+                std::cout << "Device can't draw indirect with a count or sample the depth buffer, ignoring --occlusion" << std::endl;
+                options.occlusion = false;
+            }
+        }
+
+        // depth stuff
+        CreateDepthTarget(memoryProperties, windowWidth, windowHeight);
+
+        OffscreenTarget offscreen = {};
+
+        if (options.headless)
+            CreateOffscreenTarget(offscreen, memoryProperties, windowWidth, windowHeight);
+        else if (!CreateSwapchain(swapchain, windowWidth, windowHeight, 0))
+            throw std::runtime_error("Cannot make a swapchain");
+        else
+            printf("Swapchain: %u images, %s present mode\n", swapchain.imageCount, presentModeName(presentMode));
+
+        if (options.gpuDriven && !drawIndirectCountSupported)
+        {
+            std::cout << "Device doesn't support drawIndirectCount and drawIndirectFirstInstance, drawing objects from the cpu" << std::endl;
+            options.gpuDriven = false;
+        }
+
+        // the meshlet paths draw a single object with its transform in push constants
+        if (options.meshlets && (options.objectCount > 1 || options.gpuDriven))
+        {
+            std::cout << "Meshlets are only drawn for a single object without --gpu-driven, ignoring --meshlets" << std::endl;
+            options.meshlets = false;
+        }
+
+        if (options.gpuDriven && options.instanced)
+        {
+            std::cout << "GPU driven drawing already draws every object with one call, ignoring --instanced" << std::endl;
+            options.instanced = false;
+        }
+
+        if (options.quantizeMeshes && !storage16BitSupported)
+        {
+            std::cout << "Device doesn't support 16 bit storage buffer access, using full precision vertices" << std::endl;
+            options.quantizeMeshes = false;
+        }
+
+        triangleVS = CreateShader(options.quantizeMeshes ? "shaders/mesh_quantized.vert.spv" : "shaders/mesh.vert.spv");
+        triangleFS = CreateShader("shaders/triangle.frag.spv");
+
+        auto pipelineBegin = std::chrono::high_resolution_clock::now();
+
+        TRACE_BEGIN(pipelineZone, "create pipelines");
+
+        pipelineCache = CreatePipelineCache(options.pipelineCache ? kPipelineCachePath : nullptr);
+        pipelineLayout = CreatePipelineLayout(descriptorSetLayout,
+            {
+                DescriptorBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT),
+                DescriptorBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, kMaxTextures),
+                DescriptorBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT),
+            }, VK_SHADER_STAGE_VERTEX_BIT);
+
+        pipelines.cache = pipelineCache;
+
+        // loaded into by the workers, declared first so they outlive the loader when MainLoop unwinds
+        Mesh bunny;
+        Texture tex;
+
+        // the assets and every pipeline but the triangle one are loaded and compiled on worker threads while frames render
+        AssetLoader loader;
+        CreateAssetLoader(loader, options.loaderThreads);
+
+        // compiled right away, it draws everything until the pipelines of the other paths are ready
+        trianglePipelineKey = RegisterPipeline(pipelines, nullptr, "triangle pipeline", GraphicsPipelineState(pipelineLayout,
+            { ShaderStage(VK_SHADER_STAGE_VERTEX_BIT, triangleVS), ShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, triangleFS) }));
+
+        // the mesh shader only reads full precision vertices, quantized meshes cull meshlets in compute instead
+        bool meshShading = options.meshlets && meshShadingSupported && !options.quantizeMeshes;
+        bool meshletCulling = options.meshlets && !meshShading;
+
+        if (options.meshlets)
+            printf("Culling meshlets %s\n", meshShading ? "in the task shader" : "in a compute pass that compacts the index buffer");
+
+        if (meshShading)
+        {
+            meshletTS = CreateShader("shaders/meshlet.task.spv");
+            meshletMS = CreateShader("shaders/meshlet.mesh.spv");
+
+            meshletPipelineLayout = CreatePipelineLayout(meshletSetLayout,
+                {
+                    DescriptorBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_MESH_BIT_EXT),
+                    DescriptorBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, kMaxTextures),
+                    DescriptorBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT),
+                    DescriptorBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_MESH_BIT_EXT),
+                    DescriptorBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_MESH_BIT_EXT),
+                }, VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT);
+
+            meshletPipelineKey = RegisterPipeline(pipelines, &loader, "meshlet pipeline", GraphicsPipelineState(meshletPipelineLayout,
+                {
+                    ShaderStage(VK_SHADER_STAGE_TASK_BIT_EXT, meshletTS),
+                    ShaderStage(VK_SHADER_STAGE_MESH_BIT_EXT, meshletMS),
+                    ShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, triangleFS),
+                }));
+        }
+
+        if (meshletCulling)
+        {
+            meshletCullCS = CreateShader("shaders/meshlet_cull.comp.spv");
+
+            meshletCullPipelineLayout = CreatePipelineLayout(meshletCullSetLayout,
+                {
+                    DescriptorBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+                    DescriptorBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+                    DescriptorBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+                    DescriptorBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+                    DescriptorBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+                }, VK_SHADER_STAGE_COMPUTE_BIT);
+
+            meshletCullPipelineKey = RegisterPipeline(pipelines, &loader, "meshlet culling pipeline", ComputePipelineState(meshletCullPipelineLayout, meshletCullCS));
+        }
+
+        if (options.gpuDriven)
+        {
+            drawCullCS = CreateShader("shaders/draw_cull.comp.spv");
+
+            drawCullPipelineLayout = CreatePipelineLayout(drawCullSetLayout,
+                {
+                    DescriptorBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+                    DescriptorBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+                    DescriptorBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+                    DescriptorBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+                }, VK_SHADER_STAGE_COMPUTE_BIT);
+
+            drawCullPipelineKey = RegisterPipeline(pipelines, &loader, "draw culling pipeline", ComputePipelineState(drawCullPipelineLayout, drawCullCS));
+        }
+
+        if (options.occlusion)
+        {
+            depthPyramidCS = CreateShader("shaders/depth_pyramid.comp.spv");
+            occlusionCullCS = CreateShader("shaders/occlusion_cull.comp.spv");
+
+            depthPyramidPipelineLayout = CreatePipelineLayout(depthPyramidSetLayout,
+                {
+                    DescriptorBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT),
+                    DescriptorBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT),
+                }, VK_SHADER_STAGE_COMPUTE_BIT);
+
+            occlusionCullPipelineLayout = CreatePipelineLayout(occlusionCullSetLayout,
+                {
+                    DescriptorBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+                    DescriptorBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+                    DescriptorBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+                    DescriptorBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+                    DescriptorBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+                    DescriptorBinding(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT),
+                }, VK_SHADER_STAGE_COMPUTE_BIT);
+
+            depthPyramidPipelineKey = RegisterPipeline(pipelines, &loader, "depth pyramid pipeline", ComputePipelineState(depthPyramidPipelineLayout, depthPyramidCS));
+            occlusionCullPipelineKey = RegisterPipeline(pipelines, &loader, "occlusion culling pipeline", ComputePipelineState(occlusionCullPipelineLayout, occlusionCullCS));
+        }
+
+        TRACE_END(pipelineZone);
 
-        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
-        std::vector<VkExtensionProperties> extensions(extensionCount);
-        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+        auto pipelineEnd = std::chrono::high_resolution_clock::now();
 
-        std::cout << "available extensions:\n";
+        // compare against a run with --no-pipeline-cache or without the cache file for the time a warm cache saves
+        LoadProgress pipelineProgress = GetLoadProgress(loader);
 
-        for (const auto& extension : extensions) {
-            std::cout << '\t' << extension.extensionName << '\n';
-        }
-    }
+        printf("Created pipelines in %.2f ms with a %s pipeline cache, %u compile in the background\n", std::chrono::duration<double, std::milli>(pipelineEnd - pipelineBegin).count(),
+            pipelineCacheWarm ? "warm" : "cold", pipelineProgress.queued + pipelineProgress.loading);
 
-    void CreateVulkanSemaphores()
-    {
-        VkSemaphoreCreateInfo createInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+        MeshPushConstants constants = {};
 
-        VK_CHECK(vkCreateSemaphore(device, &createInfo, 0, &acquireSemaphore));
-        VK_CHECK(vkCreateSemaphore(device, &createInfo, 0, &releaseSemaphore));
-    }
+        // the scene appears once the mesh is uploaded
 
-    void CreateCommandPool()
-    {
-        VkCommandPoolCreateInfo createInfo = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
-        createInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
-        createInfo.queueFamilyIndex = queueFamilyIndex;
+        Asset* meshAsset = LoadAssetAsync(loader, "mesh/viking_room.obj", [&bunny, this](const char* path) { return LoadMesh(bunny, path); });
+        Asset* textureAsset = LoadAssetAsync(loader, "mesh/viking_room.png", [&tex, this](const char* path) { LoadTexture(tex, path); return true; });
 
-        VK_CHECK(vkCreateCommandPool(device, &createInfo, 0, &commandPool));
-    }
+        // assets arrive one at a time, so the ring only needs to hold the largest of them in one batch and grows for larger images
+        UploadContext uploads;
+        CreateUploadContext(uploads, memoryProperties, kStagingSize);
 
-    void CreateRenderPass()
-    {
-        VkAttachmentDescription attachments[2] = {};
-        attachments[0].format = swapchainFormat;
-        attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
-        attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-        attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        attachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-        attachments[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        // a white texel stands in for the texture until it is loaded, so the mesh can be drawn first
+        static const uint8_t kPlaceholderTexel[4] = { 255, 255, 255, 255 };
+        TextureLevel placeholderLevel = { kPlaceholderTexel, sizeof(kPlaceholderTexel) };
 
-        attachments[1].format = VK_FORMAT_D32_SFLOAT;
-        attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
-        attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        Image placeholder;
+        CreateImage(placeholder, memoryProperties, VK_FORMAT_R8G8B8A8_UNORM, 1, 1, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+        UploadImage(uploads, placeholder, VK_FORMAT_R8G8B8A8_UNORM, &placeholderLevel, 1, 1, 1, 1);
 
-        VkAttachmentReference colorAttachments = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
-        VkAttachmentReference depthAttachment = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+        VkImageView placeholderImageView = CreateImageView(placeholder.image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
+        VkImageView textureImageView = placeholderImageView;
 
-        VkSubpassDescription subpass = {};
-        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-        subpass.colorAttachmentCount = 1;
-        subpass.pColorAttachments = &colorAttachments;
-        subpass.pDepthStencilAttachment = &depthAttachment;
+        // the other scene textures are generated checkerboards, so objects really sample different textures through textureIndex
+        static const uint8_t kCheckerColors[kSceneTextureCount - 1][4] = { { 230, 80, 60, 255 }, { 70, 170, 90, 255 }, { 60, 110, 220, 255 } };
 
-        VkRenderPassCreateInfo createInfo = { VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
-        createInfo.attachmentCount = sizeof(attachments) / sizeof(attachments[0]);
-        createInfo.pAttachments = attachments;
-        createInfo.subpassCount = 1;
-        createInfo.pSubpasses = &subpass;
+        Image checkers[kSceneTextureCount - 1] = {};
+        VkImageView checkerViews[kSceneTextureCount - 1] = {};
+        std::vector<uint8_t> checkerTexels(kCheckerSize * kCheckerSize * 4);
+        uint32_t checkerMipLevels = options.mips ? MipLevelCount(kCheckerSize, kCheckerSize) : 1;
 
-        VK_CHECK(vkCreateRenderPass(device, &createInfo, 0, &renderPass));
-    }
+        for (uint32_t i = 0; i < kSceneTextureCount - 1; ++i)
+        {
+            for (uint32_t y = 0; y < kCheckerSize; ++y)
+                for (uint32_t x = 0; x < kCheckerSize; ++x)
+                    memcpy(&checkerTexels[(y * kCheckerSize + x) * 4], ((x / 8 + y / 8) & 1) ? kCheckerColors[i] : kPlaceholderTexel, 4);
 
-    VkFramebuffer CreateFramebuffer(VkImageView imageView, uint32_t width, uint32_t height)
-    {
-        std::array<VkImageView, 2> attachments = { imageView, depthImageView };
+            TextureLevel checkerLevel = { checkerTexels.data(), checkerTexels.size() };
 
-        VkFramebufferCreateInfo createInfo = { VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
-        createInfo.renderPass = renderPass;
-        createInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-        createInfo.pAttachments = attachments.data();
-        createInfo.width = width;
-        createInfo.height = height;
-        createInfo.layers = 1;
+            CreateImage(checkers[i], memoryProperties, VK_FORMAT_R8G8B8A8_UNORM, kCheckerSize, kCheckerSize, UploadedImageUsage(VK_FORMAT_R8G8B8A8_UNORM, 1, checkerMipLevels), checkerMipLevels);
+            UploadImage(uploads, checkers[i], VK_FORMAT_R8G8B8A8_UNORM, &checkerLevel, 1, kCheckerSize, kCheckerSize, checkerMipLevels);
 
-        VkFramebuffer framebuffer = 0;
-        VK_CHECK(vkCreateFramebuffer(device, &createInfo, 0, &framebuffer));
+            checkerViews[i] = CreateImageView(checkers[i].image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, checkerMipLevels);
+        }
 
-        return framebuffer;
-    }
+        FlushUploads(uploads);
+        VkSampler textureSampler = CreateTextureSampler();
+        VkSampler depthSampler = options.occlusion ? CreateDepthSampler() : VK_NULL_HANDLE;
+
+        Image t = {};
+
+        // everything below is created once the mesh is loaded
+        std::vector<Object> objects;
+        glm::vec3 eye = glm::vec3(2.0f, 2.0f, 2.0f);
+        float farPlane = 10.0f;
+        glm::mat4 proj = glm::perspective(glm::radians(45.0f), windowWidth / (float)windowHeight, 0.1f, farPlane);
+        VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+
+        Buffer vb = {};
+        Buffer ib = {};
+        Buffer meshletBuffer = {};
+        Buffer meshletVertexBuffer = {};
+        Buffer meshletTriangleBuffer = {};
+        Buffer culledIndexBuffer = {};
+        Buffer drawCommandBuffer = {};
+        Buffer objectBuffer = {};
+        Buffer objectDrawBuffer = {};
+        Buffer objectDrawCountBuffer = {};
+        Buffer objectVisibilityBuffer = {};
+        Buffer lodBuffer = {};
+
+        // a mesh space error e at distance d covers e * lodScale / d threshold units on screen
+        float lodScale = windowHeight / (2.0f * tanf(glm::radians(45.0f) * 0.5f)) / options.lodThreshold;
+
+        bool sceneReady = false;
+        bool textureDone = false;
+        bool loadingReported = false;
 
-    VkImageView CreateImageView(VkImage swapchainImage, VkFormat swapchainFormat, VkImageAspectFlags aspectFlags)
-    {
-        VkImageViewCreateInfo createInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
-        createInfo.image = swapchainImage;
-        createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        createInfo.format = swapchainFormat;
-        createInfo.subresourceRange.aspectMask = aspectFlags;
-        createInfo.subresourceRange.levelCount = 1;
-        createInfo.subresourceRange.layerCount = 1;
+        float angle = 0.0f;
 
-        VkImageView imageView = 0;
-        VK_CHECK(vkCreateImageView(device, &createInfo, 0, &imageView));
+        FrameTimings timings;
+        std::vector<GpuFrameProfile> gpuProfiles;
+        std::vector<GpuFrameProfile> recentGpuProfiles;
+        uint32_t frameIndex = 0;
 
-        return imageView;
-    }
+        // runs with a frame count (--headless and --benchmark) count and time their frames from the end of loading,
+        // so clear only frames, asset uploads and background compiles don't skew the timings
+        uint32_t frameLimit = ~0u;
+        uint32_t firstMeasuredFrame = options.frameCount ? ~0u : 0;
 
-    VkShaderModule CreateShader(const char* path)
-    {
-        // Read file contents from path
-        FILE* file = fopen(path, "rb");
+        // set when acquire or present report that the swapchain no longer matches the surface
+        bool swapchainOutOfDate = false;
 
-        fseek(file, 0, SEEK_END);
-        long length = ftell(file);
-        fseek(file, 0, SEEK_SET);
+        while (options.frameCount == 0 || frameIndex < frameLimit) {
+            TRACE_ZONE("frame");
 
-        char* buffer = new char[length];
-        size_t rc = fread(buffer, 1, length, file);
-        fclose(file);
+            auto frameBegin = std::chrono::high_resolution_clock::now();
 
-        // Fill Create info struct
-        VkShaderModuleCreateInfo createInfo = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
-        createInfo.codeSize = length;
-        createInfo.pCode = reinterpret_cast<const uint32_t*>(buffer);
+            FrameData& frame = frames[frameIndex % frames.size()];
+            VkCommandBuffer commandBuffer = frame.commandBuffer;
 
-        // Create Shader module
-        VkShaderModule shaderModule = 0;
-        VK_CHECK(vkCreateShaderModule(device, &createInfo, 0, &shaderModule));
+            VkImage targetImage = offscreen.color.image;
+            VkImageView targetImageView = offscreen.colorView;
+            uint32_t targetWidth = offscreen.width;
+            uint32_t targetHeight = offscreen.height;
 
-        return shaderModule;
-    }
+            uint32_t imageIndex = 0;
 
-    VkPipelineCache CreatePipelineCache()
-    {
-        VkPipelineCacheCreateInfo createInfo = { VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
-        createInfo.initialDataSize = 0;
-        createInfo.pInitialData = nullptr;
+            if (!options.headless)
+            {
+                if (glfwWindowShouldClose(window))
+                    break;
 
-        VkPipelineCache pipelineCache = 0;
-        VK_CHECK(vkCreatePipelineCache(device, &createInfo, 0, &pipelineCache));
+                glfwPollEvents();
 
-        return pipelineCache;
-    }
+                // check if swapchain needs to be resized
+                int newWidth = 0, newHeight = 0;
+                glfwGetWindowSize(window, &newWidth, &newHeight);
 
-    VkPipelineLayout CreatePipelineLayout()
-    {
-        std::vector<VkDescriptorSetLayoutBinding> setBindings(2);
-        setBindings[0].binding = 0;
-        setBindings[0].descriptorCount = 1;
-        setBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        setBindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+                // a minimized window has no area to present to
+                if (newWidth == 0 || newHeight == 0)
+                {
+                    glfwWaitEvents();
+                    continue;
+                }
 
-        setBindings[1].binding = 1;
-        setBindings[1].descriptorCount = 1;
-        setBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        setBindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+                if (swapchainOutOfDate || swapchain.width != uint32_t(newWidth) || swapchain.height != uint32_t(newHeight))
+                {
+                    TRACE_ZONE("ResizeSwapchain");
+                    ResizeSwapchain(swapchain, memoryProperties, newWidth, newHeight, frameIndex);
+                    swapchainOutOfDate = false;
 
+                    windowWidth = newWidth;
+                    windowHeight = newHeight;
+                    proj = glm::perspective(glm::radians(45.0f), windowWidth / (float)windowHeight, 0.1f, farPlane);
+                    lodScale = windowHeight / (2.0f * tanf(glm::radians(45.0f) * 0.5f)) / options.lodThreshold;
+                }
+            }
 
-        VkDescriptorSetLayoutCreateInfo descriptorCreateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
-        descriptorCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR;
-        descriptorCreateInfo.bindingCount = static_cast<uint32_t>(setBindings.size());
-        descriptorCreateInfo.pBindings = setBindings.data();
+            // assets the loader finished are uploaded before this frame is submitted, so the frame can already draw them
+            if (!sceneReady && meshAsset->state == AssetState_Failed)
+            {
+                throw std::runtime_error("Failed to load mesh");
+            }
 
-        VK_CHECK(vkCreateDescriptorSetLayout(device, &descriptorCreateInfo, 0, &descriptorSetLayout));
+            if (!sceneReady && meshAsset->state == AssetState_Ready)
+            {
+                auto uploadBegin = std::chrono::high_resolution_clock::now();
 
-        VkPushConstantRange pushConstantRange = {};
-        pushConstantRange.offset = 0;
-        pushConstantRange.size = sizeof(MeshPushConstants);
-        pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+                if (options.meshlets && bunny.meshletCount == 0)
+                    throw std::runtime_error("Mesh has no meshlets");
 
-        VkPipelineLayoutCreateInfo createInfo = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
-        createInfo.setLayoutCount = 1;
-        createInfo.pSetLayouts = &descriptorSetLayout;
-        createInfo.pushConstantRangeCount = 1;
-        createInfo.pPushConstantRanges = &pushConstantRange;
+                constants.data = bunny.positionTransform;
 
-        VkPipelineLayout pipelineLayout = 0;
-        VK_CHECK(vkCreatePipelineLayout(device, &createInfo, 0, &pipelineLayout));
+                float sceneRadius = 0.0f;
+                objects = CreateScene(bunny, options.objectCount, kSceneTextureCount, sceneRadius);
 
-        return pipelineLayout;
-    }
+                printf("Drawing %u objects %s\n", options.objectCount,
+                    options.occlusion ? "with gpu frustum and occlusion culling in two passes" : options.gpuDriven ? "with gpu culling and vkCmdDrawIndexedIndirectCount" : options.instanced ? "with one instanced draw call" : "with a draw call per object");
 
-    VkPipeline CreateGraphicsPipeline(VkPipelineCache cache, VkShaderModule vs, VkShaderModule fs)
-    {
-        VkGraphicsPipelineCreateInfo createInfo = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+                // the camera orbits the scene, larger scenes are viewed from further away but never completely so frustum culling has work to do
+                eye = options.objectCount == 1 ? glm::vec3(2.0f, 2.0f, 2.0f) : glm::vec3(0.75f, 0.75f, 0.5f) * sceneRadius;
+                farPlane = std::max(10.0f, glm::length(eye) + sceneRadius);
+                proj = glm::perspective(glm::radians(45.0f), windowWidth / (float)windowHeight, 0.1f, farPlane);
+                indexType = bunny.indexSize == sizeof(uint16_t) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
 
-        VkPipelineShaderStageCreateInfo stages[2] = {};
-        stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
-        stages[0].module = vs;
-        stages[0].pName = "main";
-        stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-        stages[1].module = fs;
-        stages[1].pName = "main";
-
-        createInfo.stageCount = sizeof(stages) / sizeof(stages[0]);
-        createInfo.pStages = stages;
+                CreateUploadedBuffer(uploads, vb, memoryProperties, bunny.vertexData, bunny.vertexCount * bunny.vertexSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+                CreateUploadedBuffer(uploads, ib, memoryProperties, bunny.indexData, bunny.indexCount * bunny.indexSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
 
-        // everything is left to 0 because our vertex data is in the shader itself
-        VkPipelineVertexInputStateCreateInfo vertexInput = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
-        createInfo.pVertexInputState = &vertexInput;
+                if (options.meshlets)
+                {
+                    CreateUploadedBuffer(uploads, meshletBuffer, memoryProperties, bunny.meshletData, bunny.meshletCount * sizeof(Meshlet), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+                    CreateUploadedBuffer(uploads, meshletVertexBuffer, memoryProperties, bunny.meshletVertexData, bunny.meshletVertexCount * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+                    CreateUploadedBuffer(uploads, meshletTriangleBuffer, memoryProperties, bunny.meshletTriangleData, bunny.meshletTriangleSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+                }
 
-        // if using the same shader for drawing triangles and lines, then would need to change topology
-        VkPipelineInputAssemblyStateCreateInfo inputAssembly = { VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
-        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-        createInfo.pInputAssemblyState = &inputAssembly;
+                // written by the culling pass every frame, the index buffer is sized for the case where every meshlet is visible
+                if (meshletCulling)
+                {
+                    CreateDeviceBuffer(culledIndexBuffer, memoryProperties, bunny.indexCount * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+                    CreateDeviceBuffer(drawCommandBuffer, memoryProperties, sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+                }
 
-        // viewport should be set dynamically
-        VkPipelineViewportStateCreateInfo viewportState = { VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
-        viewportState.viewportCount = 1;
-        viewportState.scissorCount = 1;
-        createInfo.pViewportState = &viewportState;
+                // objects never change so they are uploaded once, the vertex shaders read them as instance data
+                CreateUploadedBuffer(uploads, objectBuffer, memoryProperties, objects.data(), objects.size() * sizeof(Object), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
 
-        VkPipelineRasterizationStateCreateInfo rasterizationState = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
-        rasterizationState.polygonMode = VK_POLYGON_MODE_FILL;
-        rasterizationState.cullMode = VK_CULL_MODE_BACK_BIT;
-        rasterizationState.lineWidth = 1.0;
-        createInfo.pRasterizationState = &rasterizationState;
+                // the culling pass rewrites the draw commands every frame and picks their index range from the lod table
+                if (options.gpuDriven)
+                {
+                    CreateUploadedBuffer(uploads, lodBuffer, memoryProperties, bunny.lods.data(), bunny.lods.size() * sizeof(MeshLod), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
 
-        VkPipelineMultisampleStateCreateInfo multisampleState = { VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
-        multisampleState.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-        createInfo.pMultisampleState = &multisampleState;
+                    // occlusion culling writes the commands and count of its late pass after the ones of the early pass
+                    size_t drawPasses = options.occlusion ? 2 : 1;
 
-        VkPipelineDepthStencilStateCreateInfo depthStencilState = { VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
-        depthStencilState.depthTestEnable = VK_TRUE;
-        depthStencilState.depthWriteEnable= VK_TRUE;
-        depthStencilState.depthCompareOp = VK_COMPARE_OP_LESS;
-        createInfo.pDepthStencilState = &depthStencilState;
+                    CreateDeviceBuffer(objectDrawBuffer, memoryProperties, drawPasses * objects.size() * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+                    CreateDeviceBuffer(objectDrawCountBuffer, memoryProperties, drawPasses * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+                }
 
-        VkPipelineColorBlendAttachmentState colorAttachmentState = {};
-        colorAttachmentState.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+                // nothing was visible in the frame before the first, so the late pass of the first frame draws everything it can't prove hidden
+                if (options.occlusion)
+                {
+                    std::vector<uint32_t> visibility(objects.size(), 0);
 
-        VkPipelineColorBlendStateCreateInfo colorBlendState = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
-        colorBlendState.attachmentCount = 1;
-        colorBlendState.pAttachments = &colorAttachmentState;
-        createInfo.pColorBlendState = &colorBlendState;
+                    CreateUploadedBuffer(uploads, objectVisibilityBuffer, memoryProperties, visibility.data(), visibility.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+                }
 
-        VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+                constants.cullCount = uint32_t(options.gpuDriven ? objects.size() : bunny.meshletCount);
 
-        VkPipelineDynamicStateCreateInfo dynamicState = { VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
-        dynamicState.dynamicStateCount = sizeof(dynamicStates) / sizeof(dynamicStates[0]);
-        dynamicState.pDynamicStates = dynamicStates;
-        createInfo.pDynamicState = &dynamicState;
+                // the frames are submitted to the graphics queue after the uploads, so rendering starts without waiting for them on the cpu
+                FlushUploads(uploads);
 
-        createInfo.layout = pipelineLayout;
-        createInfo.renderPass = renderPass;
+                meshAsset->uploadTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - uploadBegin).count();
+                meshAsset->drawableFrame = frameIndex;
+                sceneReady = true;
+            }
 
-        VkPipeline pipeline = 0;
-        VK_CHECK(vkCreateGraphicsPipelines(device, cache, 1, &createInfo, 0, &pipeline));
+            if (!textureDone && textureAsset->state == AssetState_Failed)
+            {
+                printf("Drawing with the placeholder texture\n");
+                textureDone = true;
+            }
 
-        return pipeline;
-    }
+            if (!textureDone && textureAsset->state == AssetState_Ready)
+            {
+                auto uploadBegin = std::chrono::high_resolution_clock::now();
 
+                uint32_t textureMipLevels = TextureMipLevels(tex);
 
+                uint32_t textureLevels = std::min(uint32_t(tex.levels.size()), textureMipLevels);
 
-    VkImageMemoryBarrier ImageBarrier(VkImage image,
-        VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask, VkImageLayout oldLayout, VkImageLayout newLayout)
-    {
-        VkImageMemoryBarrier result = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+                // a mip chain blitted from level 0 also makes the image a transfer source, compressed formats never take that path
+                CreateImage(t, memoryProperties, tex.format, tex.imageWidth, tex.imageHeight, UploadedImageUsage(tex.format, textureLevels, textureMipLevels), textureMipLevels);
+                UploadImage(uploads, t, tex.format, tex.levels.data(), textureLevels, tex.imageWidth, tex.imageHeight, textureMipLevels);
+                FlushUploads(uploads);
 
-        result.srcAccessMask = srcAccessMask;
-        result.dstAccessMask = dstAccessMask;
-        result.oldLayout = oldLayout;
-        result.newLayout = newLayout;
-        result.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        result.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        result.image = image;
-        result.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        result.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
-        result.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+                // frames in flight may still sample the placeholder, it lives until the end
+                textureImageView = CreateImageView(t.image, tex.format, VK_IMAGE_ASPECT_COLOR_BIT, textureMipLevels);
 
-        return result;
-    }
+                textureAsset->uploadTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - uploadBegin).count();
+                textureAsset->drawableFrame = frameIndex;
+                textureDone = true;
+            }
 
-    struct Vertex
-    {
-        float vx, vy, vz;
-        uint8_t nx, ny, nz, nw;
-        float tu, tv;
-    };
+            LoadProgress loadProgress = GetLoadProgress(loader);
 
-    struct Mesh
-    {
-        std::vector<Vertex> vertices;
-        std::vector<uint32_t> indices;
-    };
+            // pipelines compiling in the background count as assets too
+            if (!loadingReported && sceneReady && textureDone && loadProgress.queued + loadProgress.loading == 0)
+            {
+                double uploadTime = meshAsset->uploadTime + textureAsset->uploadTime;
 
-    struct Texture
-    {
-        stbi_uc* pixels;
-        uint32_t imageWidth;
-        uint32_t imageHeight;
-        uint32_t imageSize;
-    };
+                printf("Submitted %.1f MB of uploads in %u copies and %u batches on the %s queue through a %.1f MB staging ring in %.2f ms\n", double(uploads.uploadedBytes) / (1024 * 1024),
+                    uploads.copyCount, uploads.submitCount, SeparateTransferQueue(uploads) ? "transfer" : "graphics", double(uploads.staging.size) / (1024 * 1024), uploadTime);
 
-    bool LoadMesh(Mesh& result, const char* path)
-    {
-        // Load Model using tinyobjloader
-        tinyobj::ObjReaderConfig reader_config;
-        reader_config.mtl_search_path = "./"; // Path to material files
-        reader_config.triangulate = false;
+                PrintAssetTimings(loader);
+                PrintMemoryStats("after loading");
 
-        tinyobj::ObjReader reader;
+                // the background compiles are the last pipelines added, so the cache is written once here instead of periodically on the render thread
+                if (options.pipelineCache)
+                    SavePipelineCache(pipelineCache, kPipelineCachePath);
 
-        if (!reader.ParseFromFile(path, reader_config)) {
-            if (!reader.Error().empty()) {
-                std::cerr << "TinyObjReader: " << reader.Error();
+                loadingReported = true;
+
+                if (options.frameCount)
+                {
+                    frameLimit = frameIndex + options.frameCount;
+                    firstMeasuredFrame = frameIndex;
+                }
             }
-        }
 
-        if (!reader.Warning().empty()) {
-            std::cout << "TinyObjReader: " << reader.Warning();
-        }
+            // wait until the gpu is done with the last frame that used this slot, the other slots keep the gpu busy meanwhile
+            auto waitBegin = std::chrono::high_resolution_clock::now();
 
-        auto& attrib = reader.GetAttrib();
-        auto& shapes = reader.GetShapes();
-        auto& materials = reader.GetMaterials();
+            {
+                TRACE_ZONE("wait for frame fence");
+                VK_CHECK(vkWaitForFences(device, 1, &frame.fence, VK_TRUE, ~0ull));
+            }
 
-        uint32_t indexCount = 0;
+            auto waitEnd = std::chrono::high_resolution_clock::now();
 
-        for (int i = 0; i < shapes.size(); ++i)
-        {
-            indexCount += uint32_t(shapes[i].mesh.indices.size());
-        }
+            double gpuTime = -1.0;
+            uint32_t gpuFrameNumber = frame.frameNumber;
 
-        std::vector<Vertex> vertices(indexCount);
-        std::vector<uint32_t> indices(indexCount);
+            if (frame.pending)
+            {
+                FlushDeferredDestroys(frame.frameNumber + 1);
 
-        // Loop over shapes
-        for (size_t s = 0; s < shapes.size(); s++) {
-            // Loop over faces(polygon)
-            size_t index_offset = 0;
-            for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
-                size_t fv = size_t(shapes[s].mesh.num_face_vertices[f]);
+                GpuFrameProfile profile = ReadGpuProfile(frame);
 
+                gpuTime = profile.scopes[0].time;
 
-                // Loop over vertices in the face.
-                for (size_t v = 0; v < fv; v++) {
-                    Vertex& vert = vertices[index_offset + v];
+                if (gpuFrameNumber >= firstMeasuredFrame)
+                    timings.gpu.push_back(gpuTime);
 
-                    // access to vertex
-                    tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-                    vert.vx = attrib.vertices[3 * size_t(idx.vertex_index) + 0];
-                    vert.vy = attrib.vertices[3 * size_t(idx.vertex_index) + 1];
-                    vert.vz = attrib.vertices[3 * size_t(idx.vertex_index) + 2];
+                if (options.gpuProfile)
+                {
+                    recentGpuProfiles.push_back(profile);
 
-                    // Check if `normal_index` is zero or positive. negative = no normal data
-                    if (idx.normal_index >= 0) {
-                        vert.nx = uint8_t(attrib.normals[3 * size_t(idx.normal_index) + 0] * 127.0f + 127.0f);
-                        vert.ny = uint8_t(attrib.normals[3 * size_t(idx.normal_index) + 1] * 127.0f + 127.0f);
-                        vert.nz = uint8_t(attrib.normals[3 * size_t(idx.normal_index) + 2] * 127.0f + 127.0f);
+                    if (recentGpuProfiles.size() == kGpuProfileLogInterval)
+                    {
+                        PrintGpuProfile(recentGpuProfiles, 0, recentGpuProfiles.size());
+                        recentGpuProfiles.clear();
                     }
 
-                    // Check if `texcoord_index` is zero or positive. negative = no texcoord data
-                    if (idx.texcoord_index >= 0) {
-                        vert.tu = attrib.texcoords[2 * size_t(idx.texcoord_index) + 0];
-                        vert.tv = 1.0 - attrib.texcoords[2 * size_t(idx.texcoord_index) + 1];
+                    if (gpuProfiles.size() < kMaxGpuProfiles)
+                    {
+                        gpuProfiles.push_back(profile);
+
+                        if (gpuProfiles.size() == kMaxGpuProfiles)
+                            printf("Kept %u gpu frame profiles for gpu_profile.json, later frames are only logged\n", kMaxGpuProfiles);
                     }
+                }
+            }
 
-                    // Optional: vertex colors
-                    // tinyobj::real_t red   = attrib.colors[3*size_t(idx.vertex_index)+0];
-                    // tinyobj::real_t green = attrib.colors[3*size_t(idx.vertex_index)+1];
-                    // tinyobj::real_t blue  = attrib.colors[3*size_t(idx.vertex_index)+2];
-                    
-                    indices[index_offset + v] = idx.vertex_index;
+            if (!options.headless)
+            {
+                TRACE_ZONE("vkAcquireNextImageKHR");
+                VkResult acquireResult = vkAcquireNextImageKHR(device, swapchain.swapchain, ~0ull, frame.acquireSemaphore, VK_NULL_HANDLE, &imageIndex);
+
+                // nothing was acquired and the semaphore stays unsignaled, recreate the swapchain and retry this frame slot
+                if (acquireResult == VK_ERROR_OUT_OF_DATE_KHR)
+                {
+                    swapchainOutOfDate = true;
+                    continue;
                 }
-                index_offset += fv;
 
+                // a suboptimal image can still be presented, the swapchain is recreated next frame
+                if (acquireResult == VK_SUBOPTIMAL_KHR)
+                    swapchainOutOfDate = true;
+                else
+                    VK_CHECK(acquireResult);
 
-                // per-face material
-                //shapes[s].mesh.material_ids[f];
+                targetImage = swapchain.images[imageIndex];
+                targetImageView = swapchain.imageViews[imageIndex];
+                targetWidth = swapchain.width;
+                targetHeight = swapchain.height;
             }
-        }
 
-        // Use meshoptimizer to get an optimized mesh
-        std::vector<uint32_t> remap(indexCount);
-        size_t vertexCount = meshopt_generateVertexRemap(remap.data(), 0, indexCount, vertices.data(), indexCount, sizeof(Vertex));
+            VK_CHECK(vkResetFences(device, 1, &frame.fence));
+            VK_CHECK(vkResetCommandPool(device, frame.commandPool, 0));
 
-        result.vertices.resize(vertexCount);
-        result.indices.resize(indexCount);
+            VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+            TRACE_BEGIN(recordZone, "record");
+
+            VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
+            vkCmdResetQueryPool(commandBuffer, frame.timestampQueryPool, 0, 2 * kMaxGpuScopes);
+
+            frame.scopeCount = 0;
+            uint32_t frameScope = BeginGpuScope(frame, commandBuffer, "frame");
+
+            // queries can't stay active across secondary command buffers without inheritedQueries
+            frame.statisticsActive = frame.statisticsQueryPool && (frame.recordCommandBuffers.empty() || inheritedQueriesSupported);
+
+            if (frame.statisticsActive)
+            {
+                vkCmdResetQueryPool(commandBuffer, frame.statisticsQueryPool, 0, 1);
+                vkCmdBeginQuery(commandBuffer, frame.statisticsQueryPool, 0, 0);
+            }
+
+            angle += 0.1f;
+            if (angle > 360.0f) angle -= 360.0f;
+
+            glm::vec3 cameraPosition = glm::vec3(glm::rotate(glm::mat4(1.0f), glm::radians(-angle), glm::vec3(0.0f, 0.0f, 1.0f)) * glm::vec4(eye, 1.0f));
+            glm::mat4 view = glm::lookAt(cameraPosition, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+            glm::mat4 viewProjection = proj * view;
+
+            // paths whose pipelines are still compiling draw with the triangle pipeline, which needs nothing but the mesh and objects
+            VkPipeline trianglePipeline = GetPipeline(pipelines, trianglePipelineKey, frameIndex);
+            VkPipeline meshletPipeline = meshShading ? GetPipeline(pipelines, meshletPipelineKey, frameIndex) : 0;
+            VkPipeline meshletCullPipeline = meshletCulling ? GetPipeline(pipelines, meshletCullPipelineKey, frameIndex) : 0;
+            VkPipeline drawCullPipeline = options.gpuDriven ? GetPipeline(pipelines, drawCullPipelineKey, frameIndex) : 0;
+
+            // objects are only frustum culled until both occlusion pipelines are ready
+            VkPipeline depthPyramidPipeline = options.occlusion ? GetPipeline(pipelines, depthPyramidPipelineKey, frameIndex) : 0;
+            VkPipeline occlusionCullPipeline = options.occlusion ? GetPipeline(pipelines, occlusionCullPipelineKey, frameIndex) : 0;
+            bool occlusionCulling = drawCullPipeline && depthPyramidPipeline && occlusionCullPipeline && sceneReady;
+
+            // the vertex shaders apply the object transforms from the instance data
+            constants.transformationMatrix = viewProjection;
+            constants.cameraPosition = glm::vec4(cameraPosition, lodScale);
+
+            //upload the matrix to the GPU via push constants
+            vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+
+            // meshlets are culled and drawn in the space of the single object they belong to
+            MeshPushConstants meshletConstants = constants;
+
+            if (sceneReady)
+            {
+                meshletConstants.transformationMatrix = viewProjection * objects[0].model;
+                meshletConstants.cameraPosition = glm::vec4(glm::vec3(glm::inverse(objects[0].model) * glm::vec4(cameraPosition, 1.0f)), lodScale);
+            }
+
+            if (meshletCullPipeline && sceneReady)
+            {
+                uint32_t cullScope = BeginGpuScope(frame, commandBuffer, "meshlet culling");
 
-        meshopt_remapVertexBuffer(result.vertices.data(), vertices.data(), indexCount, sizeof(Vertex), remap.data());
-        meshopt_remapIndexBuffer(result.indices.data(), 0, indexCount, remap.data());
+                // the culled index buffer and draw command are shared between frames in flight, so wait for the previous draw to consume them
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, 0, 0, 0, 0, 0);
 
-        return true;
-    }
+                VkDrawIndexedIndirectCommand emptyDraw = { 0, 1, 0, 0, 0 };
+                vkCmdUpdateBuffer(commandBuffer, drawCommandBuffer.buffer, 0, sizeof(emptyDraw), &emptyDraw);
 
-    void LoadTexture(Texture& tex, const char* path) 
-    {
-        int texWidth, texHeight, texChannels;
-        stbi_uc* pixels = stbi_load(path, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-        uint32_t imageSize = texWidth * texHeight * 4;
+                VkMemoryBarrier resetBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+                resetBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                resetBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
 
-        if (!pixels) {
-            throw std::runtime_error("failed to load texture image!");
-        }
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &resetBarrier, 0, 0, 0, 0);
 
-        tex.pixels = pixels;
-        tex.imageWidth = texWidth;
-        tex.imageHeight = texHeight;
-        tex.imageSize = imageSize;
-    }
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, meshletCullPipeline);
+                vkCmdPushConstants(commandBuffer, meshletCullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MeshPushConstants), &meshletConstants);
 
-    struct Buffer
-    {
-        VkBuffer buffer;
-        VkDeviceMemory memory;
-        void* data;
-        size_t size;
-    };
+                VkDescriptorBufferInfo cullBufferInfos[] =
+                {
+                    BufferInfo(meshletBuffer), BufferInfo(meshletVertexBuffer), BufferInfo(meshletTriangleBuffer), BufferInfo(culledIndexBuffer), BufferInfo(drawCommandBuffer),
+                };
 
-    struct MeshPushConstants
-    {
-        glm::vec4 data;
-        glm::mat4 transformationMatrix;
-    };
+                VkWriteDescriptorSet cullDescriptors[5];
+                for (uint32_t i = 0; i < 5; ++i)
+                    cullDescriptors[i] = BufferDescriptor(i, &cullBufferInfos[i]);
 
-    struct Image
-    {
-        VkImage image;
-        VkDeviceMemory memory;
+                vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, meshletCullPipelineLayout, 0, 5, cullDescriptors);
+                vkCmdDispatch(commandBuffer, (constants.cullCount + kCullGroupSize - 1) / kCullGroupSize, 1, 1);
 
-    };
+                VkMemoryBarrier cullBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+                cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+                cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
 
-    uint32_t SelectMemoryType(const VkPhysicalDeviceMemoryProperties& memProps, uint32_t memoryTypeBits, VkMemoryPropertyFlags flags)
-    {
-        for (uint32_t i = 0; i < memProps.memoryTypeCount; ++i)
-        {
-            if ((memoryTypeBits & (1 << i)) != 0 && (memProps.memoryTypes[i].propertyFlags & flags) == flags)
-                return i;
-        }
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &cullBarrier, 0, 0, 0, 0);
 
-        throw std::runtime_error("No compatible memory type found");
-        return ~0u;
-    }
+                EndGpuScope(frame, commandBuffer, cullScope);
+            }
 
-    void CreateBuffer(Buffer& result, const VkPhysicalDeviceMemoryProperties& memProps, size_t size, VkBufferUsageFlags usage)
-    {
+            // the early pass draws what was visible last frame, the late pass tests everything else against the depth pyramid built in between
+            MeshPushConstants cullConstants = constants;
+            cullConstants.depthWidth = targetWidth;
+            cullConstants.depthHeight = targetHeight;
 
-        VkBufferCreateInfo createInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
-        createInfo.size = size;
-        createInfo.usage = usage;
-        
-        VkBuffer buffer = 0;
-        VK_CHECK(vkCreateBuffer(device, &createInfo, 0, &buffer));
+            VkDescriptorBufferInfo occlusionBufferInfos[] = { BufferInfo(objectBuffer), BufferInfo(objectDrawBuffer), BufferInfo(objectDrawCountBuffer), BufferInfo(lodBuffer), BufferInfo(objectVisibilityBuffer) };
+            VkDescriptorImageInfo occlusionPyramidInfo = { depthSampler, depthPyramid.view, VK_IMAGE_LAYOUT_GENERAL };
 
-        VkMemoryRequirements memoryRequirements;
-        vkGetBufferMemoryRequirements(device, buffer, &memoryRequirements);
+            VkWriteDescriptorSet occlusionDescriptors[6];
+            for (uint32_t i = 0; i < 5; ++i)
+                occlusionDescriptors[i] = BufferDescriptor(i, &occlusionBufferInfos[i]);
+            occlusionDescriptors[5] = ImageDescriptor(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &occlusionPyramidInfo);
 
-        uint32_t memoryTypeIndex = SelectMemoryType(memProps, memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+            if (drawCullPipeline && sceneReady)
+            {
+                uint32_t cullScope = BeginGpuScope(frame, commandBuffer, "draw culling");
 
-        VkMemoryAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-        allocateInfo.allocationSize = memoryRequirements.size;
-        allocateInfo.memoryTypeIndex = memoryTypeIndex;
+                // the draw commands are shared between frames in flight like the culled meshlet indices
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, 0, 0, 0, 0, 0);
 
-        VkDeviceMemory memory = 0;
-        VK_CHECK(vkAllocateMemory(device, &allocateInfo, 0, &memory));
+                vkCmdFillBuffer(commandBuffer, objectDrawCountBuffer.buffer, 0, objectDrawCountBuffer.size, 0);
 
-        VK_CHECK(vkBindBufferMemory(device, buffer, memory, 0));
+                VkMemoryBarrier resetBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+                resetBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                resetBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
 
-        void* data = 0;
-        VK_CHECK(vkMapMemory(device, memory, 0, size, 0, &data));
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &resetBarrier, 0, 0, 0, 0);
 
-        result.buffer = buffer;
-        result.memory = memory;
-        result.data = data;
-        result.size = size;
-    }
+                if (occlusionCulling)
+                {
+                    // the visibility written by the previous frame's late pass, shared between frames in flight
+                    VkMemoryBarrier visibilityBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+                    visibilityBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+                    visibilityBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
-    void CopyStagingBufferToGPU(Buffer& vb, Buffer& stagingBuffer, const VkPhysicalDeviceMemoryProperties& memProps, size_t size, VkBufferUsageFlags usage, VkQueue queue)
-    {
-        VkBufferCreateInfo createInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
-        createInfo.size = size;
-        createInfo.usage = usage;
+                    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &visibilityBarrier, 0, 0, 0, 0);
 
-        VkBuffer buffer = 0;
-        VK_CHECK(vkCreateBuffer(device, &createInfo, 0, &buffer));
+                    // phase 1 doesn't sample the pyramid but its descriptor still has to match the layout, a new pyramid is still undefined
+                    if (depthPyramid.needsTransition)
+                    {
+                        VkImageMemoryBarrier2 pyramidBarrier = ImageBarrier2(depthPyramid.image.image, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED,
+                            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_GENERAL);
 
-        VkMemoryRequirements memoryRequirements;
-        vkGetBufferMemoryRequirements(device, buffer, &memoryRequirements);
+                        PipelineBarrier(commandBuffer, 0, 1, &pyramidBarrier);
 
-        uint32_t memoryTypeIndex = SelectMemoryType(memProps, memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+                        depthPyramid.needsTransition = false;
+                    }
 
-        VkMemoryAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-        allocateInfo.allocationSize = memoryRequirements.size;
-        allocateInfo.memoryTypeIndex = memoryTypeIndex;
+                    cullConstants.cullPhase = 1;
 
-        VkDeviceMemory memory = 0;
-        VK_CHECK(vkAllocateMemory(device, &allocateInfo, 0, &memory));
+                    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, occlusionCullPipeline);
+                    vkCmdPushConstants(commandBuffer, occlusionCullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MeshPushConstants), &cullConstants);
+                    vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, occlusionCullPipelineLayout, 0, 6, occlusionDescriptors);
+                }
+                else
+                {
+                    VkDescriptorBufferInfo cullBufferInfos[] = { BufferInfo(objectBuffer), BufferInfo(objectDrawBuffer), BufferInfo(objectDrawCountBuffer), BufferInfo(lodBuffer) };
 
-        VK_CHECK(vkBindBufferMemory(device, buffer, memory, 0));
+                    VkWriteDescriptorSet cullDescriptors[4];
+                    for (uint32_t i = 0; i < 4; ++i)
+                        cullDescriptors[i] = BufferDescriptor(i, &cullBufferInfos[i]);
 
-        // submit to queue a copy buffer command
-        VkCommandBufferAllocateInfo cbAllocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
-        cbAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        cbAllocateInfo.commandPool = commandPool;
-        cbAllocateInfo.commandBufferCount = 1;
+                    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, drawCullPipeline);
+                    vkCmdPushConstants(commandBuffer, drawCullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MeshPushConstants), &constants);
+                    vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, drawCullPipelineLayout, 0, 4, cullDescriptors);
+                }
 
-        VkCommandBuffer commandBuffer = 0;
-        VK_CHECK(vkAllocateCommandBuffers(device, &cbAllocateInfo, &commandBuffer));
+                vkCmdDispatch(commandBuffer, (constants.cullCount + kCullGroupSize - 1) / kCullGroupSize, 1, 1);
 
-        VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
-        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+                VkMemoryBarrier cullBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+                cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+                cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
 
-        VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &cullBarrier, 0, 0, 0, 0);
+
+                EndGpuScope(frame, commandBuffer, cullScope);
+            }
 
-            VkBufferCopy copyRegion = {};
-            copyRegion.size = size;
-            
-            vkCmdCopyBuffer(commandBuffer, stagingBuffer.buffer, buffer, 1, &copyRegion);
+            // depth (and the offscreen color target) is shared between frames in flight so the previous frame's writes must finish before this frame clears it
+            // the stage masks chain the color barrier to the acquire semaphore wait
+            VkImageMemoryBarrier2 renderBeginBarriers[] =
+            {
+                ImageBarrier2(targetImage, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
+                    VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
+                ImageBarrier2(depthImage.image, VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
+                    VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT),
+            };
 
-        vkEndCommandBuffer(commandBuffer);
+            PipelineBarrier(commandBuffer, VK_DEPENDENCY_BY_REGION_BIT, sizeof(renderBeginBarriers) / sizeof(renderBeginBarriers[0]), renderBeginBarriers);
 
-        VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffer;
+            VkClearColorValue color = { 48.f / 256.f, 10.f / 256.f, 36.f / 256.f, 1.0f };
+            VkClearValue clearColor = { color };
+            VkClearValue depthClear = { 1.0f, 0 };
 
-        VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, 0));
-        vkQueueWaitIdle(queue);
+            VkRenderingAttachmentInfo colorAttachment = { VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+            colorAttachment.imageView = targetImageView;
+            colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+            colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+            colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+            colorAttachment.clearValue = clearColor;
+
+            VkRenderingAttachmentInfo depthAttachment = { VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+            depthAttachment.imageView = depthImageView;
+            depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+            depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+            depthAttachment.storeOp = occlusionCulling ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            depthAttachment.clearValue = depthClear;
+
+            VkRenderingInfo renderingInfo = { VK_STRUCTURE_TYPE_RENDERING_INFO };
+            renderingInfo.renderArea.extent.width = targetWidth;
+            renderingInfo.renderArea.extent.height = targetHeight;
+            renderingInfo.layerCount = 1;
+            renderingInfo.colorAttachmentCount = 1;
+            renderingInfo.pColorAttachments = &colorAttachment;
+            renderingInfo.pDepthAttachment = &depthAttachment;
 
-        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+            // -height flips the viewport because vulkan has a weird coordinate system
+            VkViewport viewport = { 0, float(targetHeight), float(targetWidth), -float(targetHeight), 0, 1 };
+            VkRect2D scissor = { {0, 0}, {targetWidth, targetHeight} };
 
-        vb.buffer = buffer;
-        vb.data = stagingBuffer.data;
-        vb.size = size;
-        vb.memory = memory;
-    }
+            // set before rendering begins, the rendering scope may only execute secondary command buffers
+            vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+            vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-    void DestroyBuffer(const Buffer& buffer)
-    {
-        vkFreeMemory(device, buffer.memory, 0);
-        vkDestroyBuffer(device, buffer.buffer, 0);
-    }
+            VkDescriptorBufferInfo vBufferInfo = BufferInfo(vb);
 
-    void DestroyImage(const Image& image)
-    {
-        vkFreeMemory(device, image.memory, 0);
-        vkDestroyImage(device, image.image, 0);
-    }
+            // every slot of the texture array must be valid, the unused ones repeat the scene textures
+            VkDescriptorImageInfo texInfos[kMaxTextures];
+            for (uint32_t i = 0; i < kMaxTextures; ++i)
+            {
+                uint32_t sceneTexture = i % kSceneTextureCount;
 
-    void CreateImage(Image& result, const VkPhysicalDeviceMemoryProperties& memProps, VkFormat format, uint32_t width, uint32_t height, VkImageUsageFlags usage)
-    {
-        VkImageCreateInfo createInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
-        createInfo.imageType = VK_IMAGE_TYPE_2D;
-        createInfo.format = format;
-        createInfo.mipLevels = 1;
-        createInfo.arrayLayers = 1;
-        createInfo.extent.width = width;
-        createInfo.extent.height = height;
-        createInfo.extent.depth = 1;
-        createInfo.usage = usage;
-        createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-        createInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+                texInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+                texInfos[i].imageView = sceneTexture == 0 ? textureImageView : checkerViews[sceneTexture - 1];
+                texInfos[i].sampler = textureSampler;
+            }
 
-        VkImage image = 0;
-        VK_CHECK(vkCreateImage(device, &createInfo, 0, &image));
+            std::vector<VkWriteDescriptorSet> writeDescriptors(2);
+            writeDescriptors[0] = BufferDescriptor(0, &vBufferInfo);
 
-        VkMemoryRequirements memoryRequirements;
-        vkGetImageMemoryRequirements(device, image, &memoryRequirements);
+            writeDescriptors[1].sType = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+            writeDescriptors[1].dstBinding = 1;
+            writeDescriptors[1].descriptorCount = kMaxTextures;
+            writeDescriptors[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            writeDescriptors[1].pImageInfo = texInfos;
 
-        uint32_t memoryTypeIndex = SelectMemoryType(memProps, memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            VkDescriptorBufferInfo objectBufferInfo = BufferInfo(objectBuffer);
 
-        VkMemoryAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-        allocateInfo.allocationSize = memoryRequirements.size;
-        allocateInfo.memoryTypeIndex = memoryTypeIndex;
+            // a draw call per object with the object index in firstInstance, the cpu cost that --instanced and --gpu-driven remove
+            auto recordObjectDraws = [&](VkCommandBuffer objectCommandBuffer, uint32_t begin, uint32_t end)
+            {
+                vkCmdBindIndexBuffer(objectCommandBuffer, ib.buffer, 0, indexType);
 
-        VkDeviceMemory memory = 0;
-        VK_CHECK(vkAllocateMemory(device, &allocateInfo, 0, &memory));
+                for (uint32_t i = begin; i < end; ++i)
+                {
+                    const MeshLod& lod = bunny.lods[objects[i].lodOffset + SelectLod(bunny.lods.data(), objects[i], cameraPosition, lodScale)];
 
-        VK_CHECK(vkBindImageMemory(device, image, memory, 0));
-   
-        result.image = image;
-        result.memory = memory;
-    }
+                    vkCmdDrawIndexed(objectCommandBuffer, lod.indexCount, 1, lod.firstIndex, objects[i].vertexOffset, i);
+                }
+            };
 
-    void TransitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, VkQueue queue)
-    {
-        // submit to queue a copy buffer command
-        VkCommandBufferAllocateInfo cbAllocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
-        cbAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        cbAllocateInfo.commandPool = commandPool;
-        cbAllocateInfo.commandBufferCount = 1;
+            // the culling dispatches push their constants through compute layouts that aren't compatible with pipelineLayout,
+            // so every draw after one (the early and late occlusion passes included) binds and pushes the graphics state again
+            auto bindTrianglePipeline = [&]()
+            {
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, trianglePipeline);
+                vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+                vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, uint32_t(writeDescriptors.size()), writeDescriptors.data());
+            };
 
-        VkCommandBuffer commandBuffer = 0;
-        VK_CHECK(vkAllocateCommandBuffers(device, &cbAllocateInfo, &commandBuffer));
+            // the per object draws are split into contiguous ranges recorded on several threads and executed in order
+            bool parallelRecording = sceneReady && frame.recordCommandBuffers.size() > 1 && !meshletPipeline && !meshletCullPipeline && !drawCullPipeline && !options.instanced;
 
-        VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
-        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            uint32_t renderPassScope = BeginGpuScope(frame, commandBuffer, "render pass");
 
-        VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+            renderingInfo.flags = parallelRecording ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0;
 
-            VkPipelineStageFlags srcStage;
-            VkPipelineStageFlags dstStage;
+            vkCmdBeginRendering(commandBuffer, &renderingInfo);
 
-            if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+            // only the clear until the mesh is loaded, parallelRecording already requires the scene
+            if (parallelRecording)
             {
-                srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-                dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+                writeDescriptors.push_back(BufferDescriptor(2, &objectBufferInfo));
 
-                VkImageMemoryBarrier memBarrier = ImageBarrier(image, 0, VK_ACCESS_TRANSFER_WRITE_BIT, oldLayout, newLayout);
-                vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &memBarrier);
+                uint32_t threadCount = uint32_t(frame.recordCommandBuffers.size());
+                uint32_t objectCount = uint32_t(objects.size());
 
-            }
-            else if(oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-            {
-                srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-                dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+                runThreadPool(recordThreadPool, threadCount, [&](uint32_t thread)
+                {
+                    TRACE_ZONE("record secondary");
 
-                VkImageMemoryBarrier memBarrier = ImageBarrier(image, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, oldLayout, newLayout);
-                vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &memBarrier);
-            }
+                    VkCommandBuffer secondary = frame.recordCommandBuffers[thread];
 
-        vkEndCommandBuffer(commandBuffer);
+                    VK_CHECK(vkResetCommandPool(device, frame.recordCommandPools[thread], 0));
 
-        VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffer;
+                    // secondaries executed inside vkCmdBeginRendering declare the attachment formats instead of a render pass
+                    VkFormat colorFormat = swapchainFormat;
 
-        VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, 0));
-        vkQueueWaitIdle(queue);
+                    VkCommandBufferInheritanceRenderingInfo inheritanceRenderingInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO };
+                    inheritanceRenderingInfo.colorAttachmentCount = 1;
+                    inheritanceRenderingInfo.pColorAttachmentFormats = &colorFormat;
+                    inheritanceRenderingInfo.depthAttachmentFormat = VK_FORMAT_D32_SFLOAT;
+                    inheritanceRenderingInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
 
-        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-    }
+                    VkCommandBufferInheritanceInfo inheritanceInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO };
+                    inheritanceInfo.pNext = &inheritanceRenderingInfo;
+                    inheritanceInfo.pipelineStatistics = frame.statisticsActive ? kGpuStatistics : 0;
 
-    void CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, VkQueue queue)
-    {
-        // submit to queue a copy buffer command
-        VkCommandBufferAllocateInfo cbAllocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
-        cbAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        cbAllocateInfo.commandPool = commandPool;
-        cbAllocateInfo.commandBufferCount = 1;
+                    VkCommandBufferBeginInfo secondaryBeginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+                    secondaryBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+                    secondaryBeginInfo.pInheritanceInfo = &inheritanceInfo;
 
-        VkCommandBuffer commandBuffer = 0;
-        VK_CHECK(vkAllocateCommandBuffers(device, &cbAllocateInfo, &commandBuffer));
+                    VK_CHECK(vkBeginCommandBuffer(secondary, &secondaryBeginInfo));
 
-        VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
-        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+                    // secondary command buffers inherit no state from the primary one
+                    vkCmdSetViewport(secondary, 0, 1, &viewport);
+                    vkCmdSetScissor(secondary, 0, 1, &scissor);
+                    vkCmdBindPipeline(secondary, VK_PIPELINE_BIND_POINT_GRAPHICS, trianglePipeline);
+                    vkCmdPushConstants(secondary, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+                    vkCmdPushDescriptorSetKHR(secondary, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, uint32_t(writeDescriptors.size()), writeDescriptors.data());
 
-        VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+                    recordObjectDraws(secondary, uint32_t(uint64_t(objectCount) * thread / threadCount), uint32_t(uint64_t(objectCount) * (thread + 1) / threadCount));
 
-            VkBufferImageCopy copyRegion = {};
-            copyRegion.bufferOffset = 0;
-            copyRegion.bufferRowLength = 0;
-            copyRegion.bufferImageHeight = 0;
+                    VK_CHECK(vkEndCommandBuffer(secondary));
+                });
 
-            copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            copyRegion.imageSubresource.mipLevel = 0;
-            copyRegion.imageSubresource.baseArrayLayer = 0;
-            copyRegion.imageSubresource.layerCount = 1;
+                vkCmdExecuteCommands(commandBuffer, threadCount, frame.recordCommandBuffers.data());
+            }
+            else if (meshletPipeline && sceneReady)
+            {
+                VkDescriptorBufferInfo meshletBufferInfos[] = { BufferInfo(meshletBuffer), BufferInfo(meshletVertexBuffer), BufferInfo(meshletTriangleBuffer) };
 
-            copyRegion.imageOffset = { 0,0,0 };
-            copyRegion.imageExtent = { width, height, 1 };
+                for (uint32_t i = 0; i < 3; ++i)
+                    writeDescriptors.push_back(BufferDescriptor(2 + i, &meshletBufferInfos[i]));
 
-            vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshletPipeline);
+                vkCmdPushConstants(commandBuffer, meshletPipelineLayout, VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT, 0, sizeof(MeshPushConstants), &meshletConstants);
+                vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshletPipelineLayout, 0, uint32_t(writeDescriptors.size()), writeDescriptors.data());
 
-        vkEndCommandBuffer(commandBuffer);
+                // every task workgroup culls kTaskGroupSize meshlets and launches a mesh workgroup per visible one
+                vkCmdDrawMeshTasksEXT(commandBuffer, (constants.cullCount + kTaskGroupSize - 1) / kTaskGroupSize, 1, 1);
+            }
+            else if (sceneReady)
+            {
+                writeDescriptors.push_back(BufferDescriptor(2, &objectBufferInfo));
 
-        VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffer;
+                bindTrianglePipeline();
+#if 0
+                VkBuffer vertexBuffers[] = { vb.buffer };
+                VkDeviceSize offsets[] = { 0 };
 
-        VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, 0));
-        vkQueueWaitIdle(queue);
+                vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+#endif
+                if (meshletCullPipeline)
+                {
+                    // firstInstance 0 selects the single object
+                    vkCmdBindIndexBuffer(commandBuffer, culledIndexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+                    vkCmdDrawIndexedIndirect(commandBuffer, drawCommandBuffer.buffer, 0, 1, sizeof(VkDrawIndexedIndirectCommand));
+                }
+                else if (drawCullPipeline)
+                {
+                    // the culling pass wrote one command per visible object, firstInstance is the object index
+                    vkCmdBindIndexBuffer(commandBuffer, ib.buffer, 0, indexType);
+                    vkCmdDrawIndexedIndirectCount(commandBuffer, objectDrawBuffer.buffer, 0, objectDrawCountBuffer.buffer, 0, uint32_t(objects.size()), sizeof(VkDrawIndexedIndirectCommand));
+                }
+                else if (options.instanced)
+                {
+                    // every object is an instance of the same index range, so all of them use the full detail lod
+                    const MeshLod& lod = bunny.lods[objects[0].lodOffset];
 
-        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-    }
+                    vkCmdBindIndexBuffer(commandBuffer, ib.buffer, 0, indexType);
+                    vkCmdDrawIndexed(commandBuffer, lod.indexCount, uint32_t(objects.size()), lod.firstIndex, objects[0].vertexOffset, 0);
+                }
+                else
+                {
+                    recordObjectDraws(commandBuffer, 0, uint32_t(objects.size()));
+                }
+            }
 
-    VkSampler CreateTextureSampler()
-    {
-        VkSamplerCreateInfo samplerInfo = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
-        samplerInfo.magFilter = VK_FILTER_LINEAR;
-        samplerInfo.minFilter = VK_FILTER_LINEAR;
-        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-        samplerInfo.mipLodBias = 0.0f;
-        samplerInfo.anisotropyEnable = VK_TRUE;
-        samplerInfo.maxAnisotropy = 1.0f;
-        samplerInfo.minLod = 0.0f;
-        samplerInfo.maxLod = 0.0f;
-        samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-        samplerInfo.unnormalizedCoordinates = VK_FALSE;
+            vkCmdEndRendering(commandBuffer);
 
-        VkSampler sampler = 0;
-        VK_CHECK(vkCreateSampler(device, &samplerInfo, 0, &sampler));
+            EndGpuScope(frame, commandBuffer, renderPassScope);
 
-        return sampler;
-    }
+            if (occlusionCulling)
+            {
+                uint32_t pyramidScope = BeginGpuScope(frame, commandBuffer, "depth pyramid");
 
-    void MainLoop()
-    {
+                // the pyramid is rebuilt from scratch and stays in GENERAL, its last reader was the previous frame's late culling pass
+                VkImageMemoryBarrier2 pyramidBeginBarriers[] =
+                {
+                    ImageBarrier2(depthImage.image, VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT),
+                    ImageBarrier2(depthPyramid.image.image, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_GENERAL,
+                        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL),
+                };
 
-        VkQueue queue = 0;
-        vkGetDeviceQueue(device, queueFamilyIndex, 0, &queue);
+                PipelineBarrier(commandBuffer, 0, sizeof(pyramidBeginBarriers) / sizeof(pyramidBeginBarriers[0]), pyramidBeginBarriers);
 
-        VkCommandBufferAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
-        allocateInfo.commandPool = commandPool;
-        allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocateInfo.commandBufferCount = 1;
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, depthPyramidPipeline);
 
-        VkCommandBuffer commandBuffer = 0;
-        VK_CHECK(vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer));
+                for (uint32_t level = 0; level < depthPyramid.levelCount; ++level)
+                {
+                    VkDescriptorImageInfo sourceInfo = { depthSampler, level == 0 ? depthImageView : depthPyramid.levels[level - 1], level == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL };
+                    VkDescriptorImageInfo destinationInfo = { VK_NULL_HANDLE, depthPyramid.levels[level], VK_IMAGE_LAYOUT_GENERAL };
 
-        GetSwapchainFormat();
+                    VkWriteDescriptorSet pyramidDescriptors[] =
+                    {
+                        ImageDescriptor(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &sourceInfo),
+                        ImageDescriptor(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, &destinationInfo),
+                    };
 
-        CreateRenderPass();
+                    vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, depthPyramidPipelineLayout, 0, 2, pyramidDescriptors);
 
-        int windowWidth;
-        int windowHeight;
-        glfwGetWindowSize(window, &windowWidth, &windowHeight);
+                    uint32_t levelWidth = std::max(depthPyramid.width >> level, 1u);
+                    uint32_t levelHeight = std::max(depthPyramid.height >> level, 1u);
 
-        VkPhysicalDeviceMemoryProperties memoryProperties;
-        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
-        
-        // depth stuff
-        CreateImage(depthImage, memoryProperties, VK_FORMAT_D32_SFLOAT, windowWidth, windowHeight, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
-        depthImageView = CreateImageView(depthImage.image, VK_FORMAT_D32_SFLOAT, VK_IMAGE_ASPECT_DEPTH_BIT);
+                    vkCmdDispatch(commandBuffer, (levelWidth + kPyramidGroupSize - 1) / kPyramidGroupSize, (levelHeight + kPyramidGroupSize - 1) / kPyramidGroupSize, 1);
 
-        if (!CreateSwapchain(swapchain, windowWidth, windowHeight, 0))
-            throw std::runtime_error("Cannot make a swapchain");
+                    // the next level reads this one
+                    VkImageMemoryBarrier2 levelBarrier = ImageBarrier2(depthPyramid.image.image, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL,
+                        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL);
 
-        triangleVS = CreateShader("shaders/mesh.vert.spv");
-        triangleFS = CreateShader("shaders/triangle.frag.spv");
+                    PipelineBarrier(commandBuffer, 0, 1, &levelBarrier);
+                }
 
-        pipelineCache = CreatePipelineCache();
-        pipelineLayout = CreatePipelineLayout();
-        trianglePipeline = CreateGraphicsPipeline(pipelineCache, triangleVS, triangleFS);
-        
+                EndGpuScope(frame, commandBuffer, pyramidScope);
 
-        // Buffers
-        Buffer stagingVertexbuffer;
-        CreateBuffer(stagingVertexbuffer, memoryProperties, 128 * 1024 * 1024, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+                uint32_t lateCullScope = BeginGpuScope(frame, commandBuffer, "occlusion culling");
 
-        Buffer ib;
-        CreateBuffer(ib, memoryProperties, 128 * 1024 * 1024, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
-        
-        Buffer stagingTexture; // staging buffer for a texture image
-        CreateBuffer(stagingTexture, memoryProperties, 128 * 1024 * 1024, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+                cullConstants.cullPhase = 2;
 
-        
-        glm::mat4 view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-        glm::mat4 proj = glm::perspective(glm::radians(45.0f), windowWidth / (float)windowHeight, 0.1f, 10.0f);
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, occlusionCullPipeline);
+                vkCmdPushConstants(commandBuffer, occlusionCullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MeshPushConstants), &cullConstants);
+                vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, occlusionCullPipelineLayout, 0, 6, occlusionDescriptors);
+                vkCmdDispatch(commandBuffer, (constants.cullCount + kCullGroupSize - 1) / kCullGroupSize, 1, 1);
 
-        MeshPushConstants constants;
+                VkMemoryBarrier lateCullBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+                lateCullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+                lateCullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
 
-        Mesh bunny;
-        LoadMesh(bunny, "mesh/viking_room.obj");
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &lateCullBarrier, 0, 0, 0, 0);
 
-        Texture tex;
-        LoadTexture(tex, "mesh/viking_room.png");
+                // the late pass depth tests against the early depth and adds to it, and loads the color the early pass wrote
+                VkImageMemoryBarrier2 lateRenderBarriers[] =
+                {
+                    ImageBarrier2(depthImage.image, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                        VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT),
+                    ImageBarrier2(targetImage, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
+                };
 
-        memcpy(stagingVertexbuffer.data, bunny.vertices.data(), bunny.vertices.size() * sizeof(Vertex));
-        memcpy(ib.data, bunny.indices.data(), bunny.indices.size() * sizeof(uint32_t));
-        memcpy(stagingTexture.data, tex.pixels, tex.imageSize);
+                PipelineBarrier(commandBuffer, 0, sizeof(lateRenderBarriers) / sizeof(lateRenderBarriers[0]), lateRenderBarriers);
 
-        Buffer vb;
-        CopyStagingBufferToGPU(vb, stagingVertexbuffer, memoryProperties, 128 * 1024 * 1024, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, queue);
+                EndGpuScope(frame, commandBuffer, lateCullScope);
 
-        Image t;
-        CreateImage(t, memoryProperties, VK_FORMAT_R8G8B8A8_UNORM, tex.imageWidth, tex.imageHeight, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
-        TransitionImageLayout(t.image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, queue);
-        CopyBufferToImage(stagingTexture.buffer, t.image, tex.imageWidth, tex.imageHeight, queue);
-        TransitionImageLayout(t.image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, queue);
-        VkImageView textureImageView = CreateImageView(t.image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
-        VkSampler textureSampler = CreateTextureSampler();
-        
-        
-        float angle = 0.0f;
+                colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+                depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+                depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+                renderingInfo.flags = 0;
 
-        while (!glfwWindowShouldClose(window)) {
-            glfwPollEvents();
+                uint32_t lateRenderScope = BeginGpuScope(frame, commandBuffer, "late render pass");
 
-            // check if swapchain needs to be resized
-            int newWidth = 0, newHeight = 0;
-            glfwGetWindowSize(window, &newWidth, &newHeight);
+                vkCmdBeginRendering(commandBuffer, &renderingInfo);
 
-            if (swapchain.width != newWidth || swapchain.height != newHeight)
-            {
-                ResizeSwapchain(swapchain, newWidth, newHeight);
+                bindTrianglePipeline();
+
+                vkCmdBindIndexBuffer(commandBuffer, ib.buffer, 0, indexType);
+                vkCmdDrawIndexedIndirectCount(commandBuffer, objectDrawBuffer.buffer, objects.size() * sizeof(VkDrawIndexedIndirectCommand), objectDrawCountBuffer.buffer, sizeof(uint32_t),
+                    uint32_t(objects.size()), sizeof(VkDrawIndexedIndirectCommand));
+
+                vkCmdEndRendering(commandBuffer);
+
+                EndGpuScope(frame, commandBuffer, lateRenderScope);
             }
 
-            uint32_t imageIndex = 0;
-            VK_CHECK(vkAcquireNextImageKHR(device, swapchain.swapchain, ~0ull, acquireSemaphore, VK_NULL_HANDLE, &imageIndex));
+            // the offscreen target stays in color attachment layout, there is no presentation engine to hand it to
+            if (!options.headless)
+            {
+                VkImageMemoryBarrier2 renderEndBarrier = ImageBarrier2(targetImage, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                    VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+                PipelineBarrier(commandBuffer, VK_DEPENDENCY_BY_REGION_BIT, 1, &renderEndBarrier);
+            }
 
-            VK_CHECK(vkResetCommandPool(device, commandPool, 0));
+            if (frame.statisticsActive)
+                vkCmdEndQuery(commandBuffer, frame.statisticsQueryPool, 0);
 
-            VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
-            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            EndGpuScope(frame, commandBuffer, frameScope);
 
-            VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+            VK_CHECK(vkEndCommandBuffer(commandBuffer));
 
-            angle += 0.1f;
-            if (angle > 360.0f) angle -= 360.0f;
+            TRACE_END(recordZone);
 
-            glm::mat4 model = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0.0f, 0.0f, 1.0f));
-            constants.transformationMatrix = proj * view * model;
+            VkPipelineStageFlags submitStageFlags = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 
-            //upload the matrix to the GPU via push constants
-            vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+            VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+            submitInfo.waitSemaphoreCount = options.headless ? 0 : 1;
+            submitInfo.pWaitSemaphores = &frame.acquireSemaphore;
+            submitInfo.pWaitDstStageMask = &submitStageFlags;
+            submitInfo.commandBufferCount = 1;
+            submitInfo.pCommandBuffers = &commandBuffer;
+            submitInfo.signalSemaphoreCount = options.headless ? 0 : 1;
+            submitInfo.pSignalSemaphores = options.headless ? 0 : &swapchain.releaseSemaphores[imageIndex];
 
-            VkImageMemoryBarrier renderBeginBarrier = ImageBarrier(swapchain.images[imageIndex], 0, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 0, 0, 1, &renderBeginBarrier);
+            {
+                TRACE_ZONE("vkQueueSubmit");
+                VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, frame.fence));
+            }
 
+            frame.pending = true;
+            frame.frameNumber = frameIndex;
 
-            VkClearColorValue color = { 48.f / 256.f, 10.f / 256.f, 36.f / 256.f, 1.0f };
-            VkClearValue clearColor = { color };
-            VkClearValue depthClear = { 1.0f, 0 };
+            auto cpuEnd = std::chrono::high_resolution_clock::now();
 
-            std::array<VkClearValue, 2> clearValues = { clearColor, depthClear };
+            if (!options.headless)
+            {
+                VkPresentInfoKHR presentInfo = { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
+                presentInfo.swapchainCount = 1;
+                presentInfo.pSwapchains = &swapchain.swapchain;
+                presentInfo.pImageIndices = &imageIndex;
+                presentInfo.waitSemaphoreCount = 1;
+                presentInfo.pWaitSemaphores = &swapchain.releaseSemaphores[imageIndex];
+
+                TRACE_ZONE("vkQueuePresentKHR");
+                VkResult presentResult = vkQueuePresentKHR(queue, &presentInfo);
+
+                if (presentResult == VK_ERROR_OUT_OF_DATE_KHR || presentResult == VK_SUBOPTIMAL_KHR)
+                    swapchainOutOfDate = true;
+                else
+                    VK_CHECK(presentResult);
+            }
 
-            VkRenderPassBeginInfo passBeginInfo = { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
-            passBeginInfo.renderPass = renderPass;
-            passBeginInfo.framebuffer = swapchain.framebuffers[imageIndex];
-            passBeginInfo.renderArea.extent.width = swapchain.width;
-            passBeginInfo.renderArea.extent.height = swapchain.height;
-            passBeginInfo.clearValueCount = static_cast<uint32_t>( clearValues.size());
-            passBeginInfo.pClearValues = clearValues.data();
+            auto frameEnd = std::chrono::high_resolution_clock::now();
 
-            vkCmdBeginRenderPass(commandBuffer, &passBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+            // cpu time excludes the time spent blocked on the frame fence, which is reported separately as wait
+            double waitTime = std::chrono::duration<double, std::milli>(waitEnd - waitBegin).count();
+            double cpuTime = std::chrono::duration<double, std::milli>(cpuEnd - frameBegin).count() - waitTime;
+            double frameTime = std::chrono::duration<double, std::milli>(frameEnd - frameBegin).count();
 
-            // -height flips the viewport because vulkan has a weird coordinate system
-            VkViewport viewport = { 0, float(swapchain.height), float(swapchain.width), -float(swapchain.height), 0, 1 };
-            VkRect2D scissor = { {0, 0}, {swapchain.width, swapchain.height} };
+            if (frameIndex >= firstMeasuredFrame)
+            {
+                timings.cpu.push_back(cpuTime);
+                timings.wait.push_back(waitTime);
+                timings.frame.push_back(frameTime);
+            }
 
-            vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-            vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+            // gpu results arrive framesInFlight frames late, once the slot's fence has signaled
+            if (options.headless && !options.benchmark && frameIndex >= firstMeasuredFrame)
+            {
+                if (gpuTime >= 0.0 && gpuFrameNumber >= firstMeasuredFrame)
+                    printf("frame %u: cpu %.3f ms, wait %.3f ms, frame %.3f ms, gpu %.3f ms (frame %u)\n", frameIndex, cpuTime, waitTime, frameTime, gpuTime, gpuFrameNumber);
+                else
+                    printf("frame %u: cpu %.3f ms, wait %.3f ms, frame %.3f ms\n", frameIndex, cpuTime, waitTime, frameTime);
+            }
+            else if (!options.headless && gpuTime >= 0.0)
+            {
+                char title[256];
+                int length = snprintf(title, sizeof(title), "cpu: %.2f ms; gpu: %.2f ms; frame: %.2f ms; %u frames in flight", cpuTime, gpuTime, frameTime, uint32_t(frames.size()));
 
-            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, trianglePipeline);
+                if (!loadingReported && length > 0 && size_t(length) < sizeof(title))
+                    snprintf(title + length, sizeof(title) - length, "; loading %u/%u assets", loadProgress.ready + loadProgress.failed, loadProgress.total);
 
-            VkDescriptorBufferInfo vBufferInfo;
-            vBufferInfo.buffer = vb.buffer;
-            vBufferInfo.offset = 0;
-            vBufferInfo.range = vb.size;
+                glfwSetWindowTitle(window, title);
+            }
 
-            VkDescriptorImageInfo texInfo;
-            texInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            texInfo.imageView = textureImageView;
-            texInfo.sampler = textureSampler;
+            frameIndex++;
+        }
 
-            std::vector<VkWriteDescriptorSet> writeDescriptors(2);
-            writeDescriptors[0].sType = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
-            writeDescriptors[0].dstBinding = 0;
-            writeDescriptors[0].descriptorCount = 1;
-            writeDescriptors[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-            writeDescriptors[0].pBufferInfo = &vBufferInfo;
+        // workers may still write into the mesh or texture when the window was closed early
+        DestroyAssetLoader(loader);
 
-            writeDescriptors[1].sType = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
-            writeDescriptors[1].dstBinding = 1;
-            writeDescriptors[1].descriptorCount = 1;
-            writeDescriptors[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-            writeDescriptors[1].pImageInfo = &texInfo;
+        VK_CHECK(vkDeviceWaitIdle(device));
 
-            vkCmdPushDescriptorSetKHR(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, uint32_t(writeDescriptors.size()), writeDescriptors.data());
-#if 0
-            VkBuffer vertexBuffers[] = { vb.buffer };
-            VkDeviceSize offsets[] = { 0 };
+        FlushDeferredDestroys(~0u);
 
-            vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-#endif
-            vkCmdBindIndexBuffer(commandBuffer, ib.buffer, 0, VK_INDEX_TYPE_UINT32);
-            vkCmdDrawIndexed(commandBuffer, uint32_t(bunny.indices.size()), 1, 0, 0, 0);
+        for (FrameData& frame : frames)
+        {
+            if (!frame.pending)
+                continue;
 
-            vkCmdEndRenderPass(commandBuffer);
+            GpuFrameProfile profile = ReadGpuProfile(frame);
 
+            if (frame.frameNumber >= firstMeasuredFrame)
+                timings.gpu.push_back(profile.scopes[0].time);
 
-            VkImageMemoryBarrier renderEndBarrier = ImageBarrier(swapchain.images[imageIndex], VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
-            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 0, 0, 1, &renderEndBarrier);
+            if (options.gpuProfile && gpuProfiles.size() < kMaxGpuProfiles)
+                gpuProfiles.push_back(profile);
+        }
 
-            VK_CHECK(vkEndCommandBuffer(commandBuffer));
+        PrintFrameTimings(timings);
 
-            VkPipelineStageFlags submitStageFlags = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        if (options.benchmark)
+            PrintBenchmark(timings);
 
-            VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
-            submitInfo.waitSemaphoreCount = 1;
-            submitInfo.pWaitSemaphores = &acquireSemaphore;
-            submitInfo.pWaitDstStageMask = &submitStageFlags;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &commandBuffer;
-            submitInfo.signalSemaphoreCount = 1;
-            submitInfo.pSignalSemaphores = &releaseSemaphore;
+        if (options.gpuProfile && !gpuProfiles.empty())
+        {
+            // the slots still pending at exit were read in slot order, sort them back into frame order for the dump
+            std::sort(gpuProfiles.begin(), gpuProfiles.end(), [](const GpuFrameProfile& a, const GpuFrameProfile& b) { return a.frameNumber < b.frameNumber; });
 
-            VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+            PrintGpuProfile(gpuProfiles, 0, gpuProfiles.size());
+            WriteGpuProfile(gpuProfiles, "gpu_profile.json");
+        }
 
-            VkPresentInfoKHR presentInfo = { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
-            presentInfo.swapchainCount = 1;
-            presentInfo.pSwapchains = &swapchain.swapchain;
-            presentInfo.pImageIndices = &imageIndex;
-            presentInfo.waitSemaphoreCount = 1;
-            presentInfo.pWaitSemaphores = &releaseSemaphore;
+        if (textureImageView != placeholderImageView)
+            vkDestroyImageView(device, textureImageView, 0);
 
-            VK_CHECK(vkQueuePresentKHR(queue, &presentInfo));
+        vkDestroyImageView(device, placeholderImageView, 0);
 
-            VK_CHECK(vkDeviceWaitIdle(device));
+        for (uint32_t i = 0; i < kSceneTextureCount - 1; ++i)
+        {
+            vkDestroyImageView(device, checkerViews[i], 0);
+            DestroyImage(checkers[i]);
         }
 
-        vkDestroyImageView(device, textureImageView, 0);
         vkDestroySampler(device, textureSampler, 0);
+        vkDestroySampler(device, depthSampler, 0);
 
         DestroyImage(t);
+        DestroyImage(placeholder);
+
+        if (options.headless)
+            DestroyOffscreenTarget(offscreen);
+
         DestroyImage(depthImage);
         vkDestroyImageView(device, depthImageView, 0);
+        DestroyDepthPyramid(depthPyramid);
 
         DestroyBuffer(vb);
         DestroyBuffer(ib);
-        DestroyBuffer(stagingTexture);
-        DestroyBuffer(stagingVertexbuffer);
+        DestroyBuffer(meshletBuffer);
+        DestroyBuffer(meshletVertexBuffer);
+        DestroyBuffer(meshletTriangleBuffer);
+        DestroyBuffer(culledIndexBuffer);
+        DestroyBuffer(drawCommandBuffer);
+        DestroyBuffer(objectBuffer);
+        DestroyBuffer(lodBuffer);
+        DestroyBuffer(objectDrawBuffer);
+        DestroyBuffer(objectDrawCountBuffer);
+        DestroyBuffer(objectVisibilityBuffer);
+
+        DestroyUploadContext(uploads);
 
-        stbi_image_free(tex.pixels);
+        DestroyMemoryAllocator();
+
+        destroyThreadPool(recordThreadPool);
+
+        FreeTexture(tex);
+        FreeMesh(bunny);
     }
 
     void Cleanup()
     {
 
-        vkDestroyPipeline(device, trianglePipeline, 0);
+        DestroyPipelineRegistry(pipelines);
+
+        if (options.pipelineCache)
+            SavePipelineCache(pipelineCache, kPipelineCachePath);
 
         vkDestroyPipelineCache(device, pipelineCache, 0);
         vkDestroyDescriptorSetLayout(device, descriptorSetLayout, 0);
         vkDestroyPipelineLayout(device, pipelineLayout, 0);
+        vkDestroyDescriptorSetLayout(device, meshletSetLayout, 0);
+        vkDestroyPipelineLayout(device, meshletPipelineLayout, 0);
+        vkDestroyDescriptorSetLayout(device, meshletCullSetLayout, 0);
+        vkDestroyPipelineLayout(device, meshletCullPipelineLayout, 0);
+        vkDestroyDescriptorSetLayout(device, drawCullSetLayout, 0);
+        vkDestroyPipelineLayout(device, drawCullPipelineLayout, 0);
+        vkDestroyDescriptorSetLayout(device, depthPyramidSetLayout, 0);
+        vkDestroyPipelineLayout(device, depthPyramidPipelineLayout, 0);
+        vkDestroyDescriptorSetLayout(device, occlusionCullSetLayout, 0);
+        vkDestroyPipelineLayout(device, occlusionCullPipelineLayout, 0);
 
         vkDestroyShaderModule(device, triangleFS, 0);
         vkDestroyShaderModule(device, triangleVS, 0);
+        vkDestroyShaderModule(device, meshletTS, 0);
+        vkDestroyShaderModule(device, meshletMS, 0);
+        vkDestroyShaderModule(device, meshletCullCS, 0);
+        vkDestroyShaderModule(device, drawCullCS, 0);
+        vkDestroyShaderModule(device, depthPyramidCS, 0);
+        vkDestroyShaderModule(device, occlusionCullCS, 0);
 
-        vkDestroyCommandPool(device, commandPool, 0);
-        vkDestroyRenderPass(device, renderPass, 0);
-
-        vkDestroySemaphore(device, acquireSemaphore, 0);
-        vkDestroySemaphore(device, releaseSemaphore, 0);
+        DestroyFrames();
 
-        DestroySwapchain(swapchain);
-        vkDestroySurfaceKHR(instance, surface, 0);
+        if (!options.headless)
+        {
+            DestroySwapchain(swapchain);
+            vkDestroySurfaceKHR(instance, surface, 0);
+        }
 
         vkDestroyDevice(device, nullptr);
-        destroyDebugCallback(instance, debugMessenger);
+
+        if (debugReportSupported)
+            destroyDebugCallback(instance, debugMessenger);
+
         vkDestroyInstance(instance, nullptr);
 
-        glfwDestroyWindow(window);
-        glfwTerminate();
+        if (!options.headless)
+        {
+            glfwDestroyWindow(window);
+            glfwTerminate();
+        }
     }
 
 private:
-    GLFWwindow* window;
+    Options options;
+
+    GLFWwindow* window = nullptr;
     VkInstance instance;
     VkPhysicalDevice physicalDevice;
     VkDevice device;
     VkSurfaceKHR surface;
     Swapchain swapchain;
-    VkSemaphore acquireSemaphore;
-    VkSemaphore releaseSemaphore;
-    VkCommandPool commandPool;
-    VkRenderPass renderPass;
     VkShaderModule triangleVS;
     VkShaderModule triangleFS;
     VkPipelineCache pipelineCache;
+    bool pipelineCacheWarm = false;
+    // contents of the cache file as last loaded or written
+    std::vector<char> pipelineCacheSaved;
     VkPipelineLayout pipelineLayout;
     VkDescriptorSetLayout descriptorSetLayout;
-    VkPipeline trianglePipeline;
+    PipelineRegistry pipelines;
+    uint64_t trianglePipelineKey = 0;
+
+    MemoryAllocator memoryAllocator;
+
+    // records secondary command buffers with --record-threads, the main thread records the first one
+    ThreadPool recordThreadPool;
+
+    // meshlet paths, left null when --meshlets is off or the path isn't used on this device
+    VkShaderModule meshletTS = 0;
+    VkShaderModule meshletMS = 0;
+    VkDescriptorSetLayout meshletSetLayout = 0;
+    VkPipelineLayout meshletPipelineLayout = 0;
+    uint64_t meshletPipelineKey = 0;
+    VkShaderModule meshletCullCS = 0;
+    VkDescriptorSetLayout meshletCullSetLayout = 0;
+    VkPipelineLayout meshletCullPipelineLayout = 0;
+    uint64_t meshletCullPipelineKey = 0;
+
+    // gpu driven object culling, left null without --gpu-driven
+    VkShaderModule drawCullCS = 0;
+    VkDescriptorSetLayout drawCullSetLayout = 0;
+    VkPipelineLayout drawCullPipelineLayout = 0;
+    uint64_t drawCullPipelineKey = 0;
+
+    // depth pyramid reduction and two pass occlusion culling, left null without --occlusion
+    VkShaderModule depthPyramidCS = 0;
+    VkDescriptorSetLayout depthPyramidSetLayout = 0;
+    VkPipelineLayout depthPyramidPipelineLayout = 0;
+    uint64_t depthPyramidPipelineKey = 0;
+    VkShaderModule occlusionCullCS = 0;
+    VkDescriptorSetLayout occlusionCullSetLayout = 0;
+    VkPipelineLayout occlusionCullPipelineLayout = 0;
+    uint64_t occlusionCullPipelineKey = 0;
+
     VkFormat swapchainFormat;
-    VkDebugReportCallbackEXT debugMessenger;
+    VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+    VkDebugReportCallbackEXT debugMessenger = 0;
+    bool debugReportSupported = false;
+
+    float maxSamplerAnisotropy = 1.0f;
+
+    bool pipelineStatisticsSupported = false;
+    bool inheritedQueriesSupported = false;
 
     uint32_t queueFamilyIndex;
+    // equal to queueFamilyIndex when the device has no transfer only family
+    uint32_t transferQueueFamilyIndex;
+
+    float timestampPeriod;
+    // the bits of a timestamp the graphics queue family defines
+    uint64_t timestampMask = ~0ull;
+
+    bool storage16BitSupported = false;
+    bool meshShadingSupported = false;
+    bool drawIndirectCountSupported = false;
+
+    std::vector<FrameData> frames;
+    std::deque<DeferredDestroy> deferredDestroys;
 
     Image depthImage;
     VkImageView depthImageView;
+    DepthPyramid depthPyramid = {};
 };
 
-int main()
+int main(int argc, char** argv)
 {
-    HelloTriangleApplication app;
-
     try
     {
+        Options options = parseOptions(argc, argv);
+
+#if TRACING
+        if (options.tracePath)
+            startTrace();
+#else
+        if (options.tracePath)
+            std::cout << "Tracing is compiled out (TRACING=0), ignoring --trace" << std::endl;
+#endif
+
+        HelloTriangleApplication app(options);
         app.Run();
+
+#if TRACING
+        // every other traced thread has been joined by now
+        if (options.tracePath)
+            writeTrace(options.tracePath);
+#endif
     }
     catch (const std::exception& e)
     {
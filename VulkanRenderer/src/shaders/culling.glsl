@@ -0,0 +1,129 @@
+// shared by the meshlet and object culling shaders, included with GL_GOOGLE_include_directive
+
+// must match Meshlet in main.cpp, the 8 bit fields are packed into uints so no 8 bit storage is needed
+struct Meshlet
+{
+    vec3 center;
+    float radius;
+    uint cone;           // snorm8 cone axis xyz and cutoff in w
+    uint vertexOffset;
+    uint triangleOffset; // in bytes
+    uint counts;         // vertex count in the low byte, triangle count in the next
+};
+
+layout(push_constant) uniform constants
+{
+    vec4 data;
+    mat4 transformationMatrix;
+    vec4 cameraPosition; // w is the lod scale
+    uint cullCount;
+    uint cullPhase;      // 1 draws last frame's visible objects, 2 tests the rest against the depth pyramid
+    uint depthWidth;     // size of the depth buffer the pyramid was built from
+    uint depthHeight;
+} PushConstants;
+
+// the planes of a view projection matrix in the space of its input, see "Fast Extraction of Viewing Frustum Planes from the World-View-Projection Matrix"
+bool sphereInFrustum(mat4 m, vec3 center, float radius)
+{
+    vec4 r0 = vec4(m[0][0], m[1][0], m[2][0], m[3][0]);
+    vec4 r1 = vec4(m[0][1], m[1][1], m[2][1], m[3][1]);
+    vec4 r2 = vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+    vec4 r3 = vec4(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    // depth is in [0, 1] so the near plane is r2 alone
+    vec4 planes[6] = vec4[6](r3 + r0, r3 - r0, r3 + r1, r3 - r1, r2, r3 - r2);
+
+    for (int i = 0; i < 6; ++i)
+        if (dot(planes[i].xyz, center) + planes[i].w < -radius * length(planes[i].xyz))
+            return false;
+
+    return true;
+}
+
+// a meshlet is backfacing when the camera is inside the cone opposite to all its triangle normals
+bool coneVisible(vec3 center, float radius, uint cone, vec3 cameraPosition)
+{
+    vec4 c = unpackSnorm4x8(cone);
+
+    return dot(center - cameraPosition, c.xyz) < c.w * length(center - cameraPosition) + radius;
+}
+
+bool meshletVisible(Meshlet meshlet)
+{
+    return sphereInFrustum(PushConstants.transformationMatrix, meshlet.center, meshlet.radius) &&
+        coneVisible(meshlet.center, meshlet.radius, meshlet.cone, PushConstants.cameraPosition.xyz);
+}
+
+// byte i of a buffer of uints, used to read the 8 bit local indices of meshlet triangles
+uint unpackByte(uint word, uint i)
+{
+    return (word >> ((i & 3) * 8)) & 0xff;
+}
+
+// must match Object in main.cpp
+struct Object
+{
+    mat4 model;
+    vec4 boundingSphere;
+    vec4 tint;
+    uint lodOffset;
+    uint lodCount;
+    int vertexOffset;
+    uint textureIndex;
+};
+
+// must match MeshLod in main.cpp
+struct MeshLod
+{
+    uint firstIndex;
+    uint indexCount;
+    float error;
+};
+
+struct DrawCommand
+{
+    uint indexCount;
+    uint instanceCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint firstInstance;
+};
+
+// the object culling shaders define OBJECT_CULLING for the buffers they share, binding 2 holds their draw counts
+#ifdef OBJECT_CULLING
+layout(binding = 0) readonly buffer Objects
+{
+    Object objects[];
+};
+
+layout(binding = 1) writeonly buffer DrawCommands
+{
+    DrawCommand drawCommands[];
+};
+
+layout(binding = 3) readonly buffer Lods
+{
+    MeshLod lods[];
+};
+
+// writes the draw of the object's coarsest lod whose error stays under the pixel threshold, cameraPosition.w is the lod scale
+void writeDrawCommand(uint slot, uint objectIndex)
+{
+    vec4 boundingSphere = objects[objectIndex].boundingSphere;
+    float distance = max(length(boundingSphere.xyz - PushConstants.cameraPosition.xyz) - boundingSphere.w, 0.0);
+
+    uint lodIndex = objects[objectIndex].lodOffset;
+
+    for (uint i = 1; i < objects[objectIndex].lodCount; ++i)
+        if (lods[objects[objectIndex].lodOffset + i].error * PushConstants.cameraPosition.w <= distance)
+            lodIndex = objects[objectIndex].lodOffset + i;
+
+    MeshLod lod = lods[lodIndex];
+
+    drawCommands[slot].indexCount = lod.indexCount;
+    drawCommands[slot].instanceCount = 1;
+    drawCommands[slot].firstIndex = lod.firstIndex;
+    drawCommands[slot].vertexOffset = objects[objectIndex].vertexOffset;
+    drawCommands[slot].firstInstance = objectIndex;
+}
+#endif
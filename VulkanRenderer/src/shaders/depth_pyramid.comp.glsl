@@ -0,0 +1,38 @@
+#version 450
+
+// must match kPyramidGroupSize in main.cpp
+layout(local_size_x = 8, local_size_y = 8) in;
+
+// the depth buffer for level 0, the previous pyramid level otherwise
+layout(binding = 0) uniform sampler2D source;
+
+layout(binding = 1, r32f) uniform writeonly image2D destination;
+
+void main()
+{
+    ivec2 position = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 destinationSize = imageSize(destination);
+
+    if (any(greaterThanEqual(position, destinationSize)))
+        return;
+
+    ivec2 sourceSize = textureSize(source, 0);
+
+    // mip sizes round down, so the last texel of an odd sized source is folded into the last texel of the level
+    ivec2 begin = position * 2;
+    ivec2 end = min(begin + 1, sourceSize - 1);
+
+    if (position.x == destinationSize.x - 1)
+        end.x = sourceSize.x - 1;
+    if (position.y == destinationSize.y - 1)
+        end.y = sourceSize.y - 1;
+
+    // the farthest depth, anything behind it is hidden everywhere in the texel's footprint
+    float depth = 0.0;
+
+    for (int y = begin.y; y <= end.y; ++y)
+        for (int x = begin.x; x <= end.x; ++x)
+            depth = max(depth, texelFetch(source, ivec2(x, y), 0).x);
+
+    imageStore(destination, position, vec4(depth));
+}
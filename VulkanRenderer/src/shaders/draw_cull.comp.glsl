@@ -0,0 +1,33 @@
+#version 450
+
+#extension GL_GOOGLE_include_directive : require
+
+#define OBJECT_CULLING
+#include "culling.glsl"
+
+// must match kCullGroupSize in main.cpp
+layout(local_size_x = 64) in;
+
+// reset to 0 before the dispatch, read by vkCmdDrawIndexedIndirectCount
+layout(binding = 2) buffer DrawCount
+{
+    uint drawCount;
+};
+
+void main()
+{
+    uint objectIndex = gl_GlobalInvocationID.x;
+
+    if (objectIndex >= PushConstants.cullCount)
+        return;
+
+    vec4 boundingSphere = objects[objectIndex].boundingSphere;
+
+    // transformationMatrix is the view projection matrix, the bounding spheres are in world space
+    if (!sphereInFrustum(PushConstants.transformationMatrix, boundingSphere.xyz, boundingSphere.w))
+        return;
+
+    uint slot = atomicAdd(drawCount, 1);
+
+    writeDrawCommand(slot, objectIndex);
+}
@@ -14,16 +14,38 @@ layout(binding = 0) buffer Vertices
     Vertex vertices[];
 };
 
+// per instance data, must match Object in main.cpp
+struct Object
+{
+    mat4 model;
+    vec4 boundingSphere;
+    vec4 tint;
+    uint lodOffset;
+    uint lodCount;
+    int vertexOffset;
+    uint textureIndex;
+};
+
+layout(binding = 2) readonly buffer Objects
+{
+    Object objects[];
+};
+
 layout( push_constant) uniform constants
 {
     vec4 data;
-    mat4 transformationMatrix;
+    mat4 transformationMatrix; // view projection, the model matrix comes from the instance
 } PushConstants;
 
 layout(location = 0) out vec2 fragTexCoord;
+layout(location = 1) out vec4 fragTint;
+layout(location = 2) flat out uint fragTextureIndex;
 
 void main()
 {
+    // gl_InstanceIndex includes firstInstance, which the per object and indirect draws set to the object index
+    Object object = objects[gl_InstanceIndex];
+
     Vertex v = vertices[gl_VertexIndex];
 
     vec3 position = vec3(v.vx, v.vy, v.vz);
@@ -32,8 +54,10 @@ void main()
 
     //gl_Position = vec4(position + vec3(0, 0, 0.5), 1);
 
-    gl_Position = PushConstants.transformationMatrix * vec4(position, 1.0);
+    gl_Position = PushConstants.transformationMatrix * object.model * vec4(position, 1.0);
     
     //color = vec4(normal * 0.5 + 0.3, 1.0);
     fragTexCoord = texCoord;
+    fragTint = object.tint;
+    fragTextureIndex = object.textureIndex;
 }
\ No newline at end of file
@@ -0,0 +1,73 @@
+#version 450
+
+#extension GL_EXT_shader_16bit_storage : require
+#extension GL_EXT_shader_8bit_storage : require
+#extension GL_EXT_shader_explicit_arithmetic_types_int8 : require
+
+// must match QuantizedVertex in main.cpp
+struct Vertex
+{
+    uint16_t vx, vy, vz;
+    int8_t nu, nv;
+    float16_t tu, tv;
+};
+
+layout(binding = 0) readonly buffer Vertices
+{
+    Vertex vertices[];
+};
+
+// per instance data, must match Object in main.cpp
+struct Object
+{
+    mat4 model;
+    vec4 boundingSphere;
+    vec4 tint;
+    uint lodOffset;
+    uint lodCount;
+    int vertexOffset;
+    uint textureIndex;
+};
+
+layout(binding = 2) readonly buffer Objects
+{
+    Object objects[];
+};
+
+layout( push_constant) uniform constants
+{
+    vec4 data; // xyz = position offset, w = position scale
+    mat4 transformationMatrix; // view projection, the model matrix comes from the instance
+} PushConstants;
+
+layout(location = 0) out vec2 fragTexCoord;
+layout(location = 1) out vec4 fragTint;
+layout(location = 2) flat out uint fragTextureIndex;
+
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e.x, e.y, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+void main()
+{
+    // gl_InstanceIndex includes firstInstance, which the per object and indirect draws set to the object index
+    Object object = objects[gl_InstanceIndex];
+
+    // 16 bit members are read one at a time, only storage access to them is allowed
+    vec3 position = vec3(uint(vertices[gl_VertexIndex].vx), uint(vertices[gl_VertexIndex].vy), uint(vertices[gl_VertexIndex].vz)) / 65535.0;
+    position = PushConstants.data.xyz + position * PushConstants.data.w;
+
+    vec3 normal = decodeOctahedral(max(vec2(int(vertices[gl_VertexIndex].nu), int(vertices[gl_VertexIndex].nv)) / 127.0, -1.0));
+    vec2 texCoord = vec2(float(vertices[gl_VertexIndex].tu), float(vertices[gl_VertexIndex].tv));
+
+    gl_Position = PushConstants.transformationMatrix * object.model * vec4(position, 1.0);
+
+    fragTexCoord = texCoord;
+    fragTint = object.tint;
+    fragTextureIndex = object.textureIndex;
+}
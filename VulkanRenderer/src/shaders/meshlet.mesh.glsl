@@ -0,0 +1,82 @@
+#version 450
+
+#extension GL_EXT_mesh_shader : require
+#extension GL_EXT_shader_explicit_arithmetic_types_int8 : require
+#extension GL_GOOGLE_include_directive : require
+
+#include "culling.glsl"
+
+layout(local_size_x = 64) in;
+
+// must match kMeshletMaxVertices and kMeshletMaxTriangles in main.cpp
+layout(triangles, max_vertices = 64, max_primitives = 124) out;
+
+struct Vertex
+{
+    float vx, vy, vz;
+    uint8_t nx, ny, nz;
+    float tu, tv;
+};
+
+layout(binding = 0) readonly buffer Vertices
+{
+    Vertex vertices[];
+};
+
+layout(binding = 2) readonly buffer Meshlets
+{
+    Meshlet meshlets[];
+};
+
+layout(binding = 3) readonly buffer MeshletVertices
+{
+    uint meshletVertices[];
+};
+
+layout(binding = 4) readonly buffer MeshletTriangles
+{
+    uint meshletTriangles[];
+};
+
+struct TaskPayload
+{
+    uint meshletIndices[32];
+};
+
+taskPayloadSharedEXT TaskPayload payload;
+
+layout(location = 0) out vec2 fragTexCoord[];
+layout(location = 1) out vec4 fragTint[];
+layout(location = 2) flat out uint fragTextureIndex[];
+
+void main()
+{
+    Meshlet meshlet = meshlets[payload.meshletIndices[gl_WorkGroupID.x]];
+
+    uint vertexCount = meshlet.counts & 0xff;
+    uint triangleCount = (meshlet.counts >> 8) & 0xff;
+
+    SetMeshOutputsEXT(vertexCount, triangleCount);
+
+    for (uint i = gl_LocalInvocationIndex; i < vertexCount; i += 64)
+    {
+        Vertex v = vertices[meshletVertices[meshlet.vertexOffset + i]];
+
+        gl_MeshVerticesEXT[i].gl_Position = PushConstants.transformationMatrix * vec4(v.vx, v.vy, v.vz, 1.0);
+        fragTexCoord[i] = vec2(v.tu, v.tv);
+
+        // meshlets are drawn for a single untinted object
+        fragTint[i] = vec4(1.0);
+        fragTextureIndex[i] = 0;
+    }
+
+    for (uint i = gl_LocalInvocationIndex; i < triangleCount; i += 64)
+    {
+        uint byteIndex = meshlet.triangleOffset + i * 3;
+
+        gl_PrimitiveTriangleIndicesEXT[i] = uvec3(
+            unpackByte(meshletTriangles[byteIndex / 4], byteIndex),
+            unpackByte(meshletTriangles[(byteIndex + 1) / 4], byteIndex + 1),
+            unpackByte(meshletTriangles[(byteIndex + 2) / 4], byteIndex + 2));
+    }
+}
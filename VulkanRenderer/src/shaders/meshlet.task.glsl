@@ -0,0 +1,44 @@
+#version 450
+
+#extension GL_EXT_mesh_shader : require
+#extension GL_GOOGLE_include_directive : require
+
+#include "culling.glsl"
+
+// must match kTaskGroupSize in main.cpp
+layout(local_size_x = 32) in;
+
+layout(binding = 2) readonly buffer Meshlets
+{
+    Meshlet meshlets[];
+};
+
+struct TaskPayload
+{
+    uint meshletIndices[32];
+};
+
+taskPayloadSharedEXT TaskPayload payload;
+
+shared uint visibleCount;
+
+void main()
+{
+    uint meshletIndex = gl_GlobalInvocationID.x;
+
+    if (gl_LocalInvocationIndex == 0)
+        visibleCount = 0;
+
+    barrier();
+
+    if (meshletIndex < PushConstants.cullCount && meshletVisible(meshlets[meshletIndex]))
+    {
+        uint slot = atomicAdd(visibleCount, 1);
+        payload.meshletIndices[slot] = meshletIndex;
+    }
+
+    barrier();
+
+    // one mesh workgroup per visible meshlet
+    EmitMeshTasksEXT(visibleCount, 1, 1);
+}
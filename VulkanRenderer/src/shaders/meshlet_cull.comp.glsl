@@ -0,0 +1,63 @@
+#version 450
+
+#extension GL_GOOGLE_include_directive : require
+
+#include "culling.glsl"
+
+// must match kCullGroupSize in main.cpp
+layout(local_size_x = 64) in;
+
+layout(binding = 0) readonly buffer Meshlets
+{
+    Meshlet meshlets[];
+};
+
+layout(binding = 1) readonly buffer MeshletVertices
+{
+    uint meshletVertices[];
+};
+
+layout(binding = 2) readonly buffer MeshletTriangles
+{
+    uint meshletTriangles[];
+};
+
+layout(binding = 3) writeonly buffer Indices
+{
+    uint indices[];
+};
+
+// a VkDrawIndexedIndirectCommand, indexCount is reset to 0 before the dispatch
+layout(binding = 4) buffer DrawCommand
+{
+    uint indexCount;
+    uint instanceCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint firstInstance;
+} draw;
+
+void main()
+{
+    uint meshletIndex = gl_GlobalInvocationID.x;
+
+    if (meshletIndex >= PushConstants.cullCount)
+        return;
+
+    Meshlet meshlet = meshlets[meshletIndex];
+
+    if (!meshletVisible(meshlet))
+        return;
+
+    // append the meshlet triangles to the compacted index buffer as global vertex indices
+    uint indexCount = ((meshlet.counts >> 8) & 0xff) * 3;
+    uint offset = atomicAdd(draw.indexCount, indexCount);
+
+    for (uint i = 0; i < indexCount; ++i)
+    {
+        uint byteIndex = meshlet.triangleOffset + i;
+        uint localIndex = unpackByte(meshletTriangles[byteIndex / 4], byteIndex);
+
+        indices[offset + i] = meshletVertices[meshlet.vertexOffset + localIndex];
+    }
+}
@@ -0,0 +1,116 @@
+#version 450
+
+#extension GL_GOOGLE_include_directive : require
+
+#define OBJECT_CULLING
+#include "culling.glsl"
+
+// must match kCullGroupSize in main.cpp
+layout(local_size_x = 64) in;
+
+// one count per phase, reset to 0 before the early dispatch and read by vkCmdDrawIndexedIndirectCount
+// the early phase writes the first cullCount draw commands, the late phase the ones after them
+layout(binding = 2) buffer DrawCounts
+{
+    uint drawCounts[2];
+};
+
+// 1 for the objects that passed the late phase last frame
+layout(binding = 4) buffer Visibility
+{
+    uint visibility[];
+};
+
+// max reduction of the depth buffer, only read by the late phase
+layout(binding = 5) uniform sampler2D depthPyramid;
+
+// the screen rectangle and nearest depth of the sphere's bounding box against the farthest depth of the pyramid texels under it
+bool sphereOccluded(mat4 viewProjection, vec3 center, float radius)
+{
+    vec2 minPixel = vec2(PushConstants.depthWidth, PushConstants.depthHeight);
+    vec2 maxPixel = vec2(0.0);
+    float nearestDepth = 1.0;
+
+    for (int i = 0; i < 8; ++i)
+    {
+        vec3 corner = center + radius * vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = viewProjection * vec4(corner, 1.0);
+
+        // boxes crossing the near plane have no meaningful projection
+        if (clip.z < 0.0)
+            return false;
+
+        vec3 ndc = clip.xyz / clip.w;
+
+        // the viewport flips y, the top row of the depth buffer is at ndc y = 1
+        vec2 pixel = vec2(ndc.x * 0.5 + 0.5, 0.5 - ndc.y * 0.5) * vec2(PushConstants.depthWidth, PushConstants.depthHeight);
+
+        minPixel = min(minPixel, pixel);
+        maxPixel = max(maxPixel, pixel);
+        nearestDepth = min(nearestDepth, ndc.z);
+    }
+
+    ivec2 depthLast = ivec2(PushConstants.depthWidth, PushConstants.depthHeight) - 1;
+    ivec2 p0 = ivec2(clamp(minPixel, vec2(0.0), vec2(depthLast)));
+    ivec2 p1 = ivec2(clamp(maxPixel, vec2(0.0), vec2(depthLast)));
+
+    // texel x of level l covers depth pixels x << (l + 1) onwards, the last texel also covers the odd leftovers
+    int levelCount = textureQueryLevels(depthPyramid);
+    int level = 0;
+    ivec2 t0, t1;
+
+    for (;; ++level)
+    {
+        ivec2 levelLast = textureSize(depthPyramid, level) - 1;
+
+        t0 = min(p0 >> (level + 1), levelLast);
+        t1 = min(p1 >> (level + 1), levelLast);
+
+        // the rectangle fits in 2x2 texels of this level
+        if (level == levelCount - 1 || all(lessThanEqual(t1 - t0, ivec2(1))))
+            break;
+    }
+
+    float farthestDepth = max(max(texelFetch(depthPyramid, t0, level).x, texelFetch(depthPyramid, ivec2(t1.x, t0.y), level).x),
+        max(texelFetch(depthPyramid, ivec2(t0.x, t1.y), level).x, texelFetch(depthPyramid, t1, level).x));
+
+    return nearestDepth > farthestDepth;
+}
+
+void main()
+{
+    uint objectIndex = gl_GlobalInvocationID.x;
+
+    if (objectIndex >= PushConstants.cullCount)
+        return;
+
+    vec4 boundingSphere = objects[objectIndex].boundingSphere;
+
+    // transformationMatrix is the view projection matrix, the bounding spheres are in world space
+    bool visible = sphereInFrustum(PushConstants.transformationMatrix, boundingSphere.xyz, boundingSphere.w);
+
+    // the early phase draws what was visible last frame, which is likely still visible and fills most of the depth buffer
+    bool drawnEarly = visible && visibility[objectIndex] != 0;
+
+    if (PushConstants.cullPhase == 1)
+    {
+        if (!drawnEarly)
+            return;
+    }
+    else
+    {
+        // the pyramid holds this frame's early depth, objects behind it stay hidden until they show up again
+        if (visible)
+            visible = !sphereOccluded(PushConstants.transformationMatrix, boundingSphere.xyz, boundingSphere.w);
+
+        visibility[objectIndex] = visible ? 1u : 0u;
+
+        if (!visible || drawnEarly)
+            return;
+    }
+
+    uint phase = PushConstants.cullPhase - 1;
+    uint slot = phase * PushConstants.cullCount + atomicAdd(drawCounts[phase], 1);
+
+    writeDrawCommand(slot, objectIndex);
+}
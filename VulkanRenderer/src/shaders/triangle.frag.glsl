@@ -1,12 +1,19 @@
 #version 450
 
+#extension GL_EXT_nonuniform_qualifier : require
+
 layout(location = 0) out vec4 outColor;
 
 
 layout(location = 0) in vec2 fragTexCoord;
-layout(binding = 1) uniform sampler2D texSampler;
+layout(location = 1) in vec4 fragTint;
+layout(location = 2) flat in uint fragTextureIndex;
+
+// must match kMaxTextures in main.cpp, unused slots repeat the loaded textures
+layout(binding = 1) uniform sampler2D textures[8];
 
 void main()
 {
-  outColor = texture(texSampler, fragTexCoord);
-}
\ No newline at end of file
+  // instances in one draw can use different textures
+  outColor = texture(textures[nonuniformEXT(fragTextureIndex)], fragTexCoord) * fragTint;
+}